@@ -1,9 +1,10 @@
 #include "apu.h"
 
-#include "emulator.h"
+#include <string.h>
+
 #include "gb.h"
 
-u8 duty_cycles[] = {0b11111110, 0b01111110, 0b01111000, 0b10000001};
+static const u8 duty_cycles[] = {0b11111110, 0b01111110, 0b01111000, 0b10000001};
 
 u8 get_sample_ch1(struct gb_apu* apu) {
     return (duty_cycles[(apu->master->io[NR11] & NRX1_DUTY) >> 6] &
@@ -40,191 +41,370 @@ u8 get_sample_ch4(struct gb_apu* apu) {
     return (apu->ch4_lfsr & 1) ? apu->ch4_volume : 0;
 }
 
-void apu_clock(struct gb_apu* apu) {
-    if (!(apu->master->io[NR52] & 0b10000000)) {
-        apu->master->io[NR52] = 0;
-        apu->apu_div = 0;
-        apu->sample_ind = 0;
-        apu->global_counter = 0;
-        return;
+// whether output is mixed at all. otherwise the channels only keep their
+// state, and the band-limited output stays silent
+static bool mixing(struct gb_apu* apu) {
+    return !(apu->master->cfg.render_skip & SKIP_AUDIO);
+}
+
+// records a change in a channel's output level on the band-limited path, at
+// the given value of global_counter
+static void update_output(struct gb_apu* apu, int ch, long clock) {
+    u8 level = 0;
+    if ((apu->master->io[NR52] & 0b10000000) && mixing(apu)) {
+        switch (ch) {
+            case 0:
+                level = apu->ch1_enable ? get_sample_ch1(apu) : 0;
+                break;
+            case 1:
+                level = apu->ch2_enable ? get_sample_ch2(apu) : 0;
+                break;
+            case 2:
+                level = apu->ch3_enable ? get_sample_ch3(apu) : 0;
+                break;
+            case 3:
+                level = apu->ch4_enable ? get_sample_ch4(apu) : 0;
+                break;
+        }
+    }
+    int amp[2] = {0, 0};
+    if (apu->master->io[NR51] & (1 << (ch + 4)))
+        amp[0] = level * (((apu->master->io[NR50] & 0b01110000) >> 4) + 1);
+    if (apu->master->io[NR51] & (1 << ch))
+        amp[1] = level * ((apu->master->io[NR50] & 0b00000111) + 1);
+    for (int i = 0; i < 2; i++) {
+        if (amp[i] != apu->out_amp[ch][i]) {
+            blip_add_delta(&apu->blip[i], apu->blip_base + clock,
+                           amp[i] - apu->out_amp[ch][i]);
+            apu->out_amp[ch][i] = amp[i];
+        }
     }
+}
 
-    apu->master->io[NR52] = 0b10000000 | (apu->ch1_enable ? 0b0001 : 0) |
-                            (apu->ch2_enable ? 0b0010 : 0) |
-                            (apu->ch3_enable ? 0b0100 : 0) |
-                            (apu->ch4_enable ? 0b1000 : 0);
+// advances a pulse or wave channel over the clocks (from, to], on which it
+// steps every k clocks. the counter counts up to 2048 and is then reloaded
+// from the wavelength, moving the waveform on by one
+static void step_wave(struct gb_apu* apu, int ch, u16* counter, u16 wavelen,
+                      u8* index, long from, long to, int k) {
+    long n = to / k - from / k;
+    // a wavelength swept past 2047 makes the counter wrap around to 2048
+    long first = (u16) (2048 - *counter);
+    if (first == 0) first = 0x10000;
+    if (n < first) {
+        *counter += n;
+        return;
+    }
+    n -= first;
+    (*index)++;
+    long period = (u16) (2048 - wavelen);
+    if (period == 0) period = 0x10000;
+    if (apu->sample_rate && mixing(apu)) {
+        long step = from / k + first;
+        update_output(apu, ch, step * k);
+        for (; n >= period; n -= period) {
+            step += period;
+            (*index)++;
+            update_output(apu, ch, step * k);
+        }
+        *counter = wavelen + n;
+    } else {
+        *index += n / period;
+        *counter = wavelen + n % period;
+    }
+}
 
-    int effective_speed = gbemu.speed;
-    if (apu->master->io[KEY1] & (1 << 7)) effective_speed *= 2;
-    if (apu->master->div % effective_speed == 0) {
-        apu->global_counter++;
-
-        if (apu->global_counter % 2 == 0) {
-            apu->ch3_counter++;
-            if (apu->ch3_counter == 2048) {
-                apu->ch3_counter = apu->ch3_wavelen;
-                apu->ch3_sample_index++;
-            }
+static void step_noise(struct gb_apu* apu, long from, long to) {
+    int rate = 2 << ((apu->master->io[NR43] & NR43_SHIFT) >> 4);
+    if (apu->master->io[NR43] & NR43_DIV) {
+        rate *= apu->master->io[NR43] & NR43_DIV;
+    }
+    long n = to / 8 - from / 8;
+    long step = from / 8;
+    while (n > 0) {
+        long first = rate - apu->ch4_counter;
+        if (first < 1) first = 1;
+        if (n < first) {
+            apu->ch4_counter += n;
+            return;
+        }
+        n -= first;
+        step += first;
+        apu->ch4_counter = 0;
+        u16 bit = (~(apu->ch4_lfsr ^ (apu->ch4_lfsr >> 1))) & 1;
+        apu->ch4_lfsr = (apu->ch4_lfsr & ~(1 << 15)) | (bit << 15);
+        if (apu->master->io[NR43] & NR43_WIDTH) {
+            apu->ch4_lfsr = (apu->ch4_lfsr & ~(1 << 7)) | (bit << 7);
         }
+        apu->ch4_lfsr >>= 1;
+        if (apu->sample_rate && mixing(apu)) update_output(apu, 3, step * 8);
+    }
+}
 
-        if (apu->global_counter % 4 == 0) {
-            apu->ch1_counter++;
-            if (apu->ch1_counter == 2048) {
-                apu->ch1_counter = apu->ch1_wavelen;
-                apu->ch1_duty_index++;
-            }
+static void take_sample(struct gb_apu* apu) {
+    u8 ch1_sample = apu->ch1_enable ? get_sample_ch1(apu) : 0;
+    u8 ch2_sample = apu->ch2_enable ? get_sample_ch2(apu) : 0;
+    u8 ch3_sample = apu->ch3_enable ? get_sample_ch3(apu) : 0;
+    u8 ch4_sample = apu->ch4_enable ? get_sample_ch4(apu) : 0;
 
-            apu->ch2_counter++;
-            if (apu->ch2_counter == 2048) {
-                apu->ch2_counter = apu->ch2_wavelen;
-                apu->ch2_duty_index++;
-            }
-        }
+    u8 l_sample = 0, r_sample = 0;
+    if (apu->master->io[NR51] & (1 << 0)) r_sample += ch1_sample;
+    if (apu->master->io[NR51] & (1 << 1)) r_sample += ch2_sample;
+    if (apu->master->io[NR51] & (1 << 2)) r_sample += ch3_sample;
+    if (apu->master->io[NR51] & (1 << 3)) r_sample += ch4_sample;
+    if (apu->master->io[NR51] & (1 << 4)) l_sample += ch1_sample;
+    if (apu->master->io[NR51] & (1 << 5)) l_sample += ch2_sample;
+    if (apu->master->io[NR51] & (1 << 6)) l_sample += ch3_sample;
+    if (apu->master->io[NR51] & (1 << 7)) l_sample += ch4_sample;
 
-        if (apu->global_counter % 8 == 0) {
-            apu->ch4_counter++;
-            int rate = 2 << ((apu->master->io[NR43] & NR43_SHIFT) >> 4);
-            if (apu->master->io[NR43] & NR43_DIV) {
-                rate *= apu->master->io[NR43] & NR43_DIV;
-            }
-            if (apu->ch4_counter >= rate) {
-                apu->ch4_counter = 0;
-                u16 bit = (~(apu->ch4_lfsr ^ (apu->ch4_lfsr >> 1))) & 1;
-                apu->ch4_lfsr = (apu->ch4_lfsr & ~(1 << 15)) | (bit << 15);
-                if (apu->master->io[NR43] & NR43_WIDTH) {
-                    apu->ch4_lfsr = (apu->ch4_lfsr & ~(1 << 7)) | (bit << 7);
-                }
-                apu->ch4_lfsr >>= 1;
-            }
-        }
+    apu->sample_buf[apu->buf_ind%2][apu->sample_ind++] =
+        (float) l_sample / 500 *
+        (((apu->master->io[NR50] & 0b01110000) >> 4) + 1);
+    apu->sample_buf[apu->buf_ind%2][apu->sample_ind++] =
+        (float) r_sample / 500 *
+        ((apu->master->io[NR50] & 0b00000111) + 1);
+    if (apu->sample_ind == SAMPLE_BUF_LEN) {
+        apu->sample_ind = 0;
+        apu->buf_ind++;
+    }
+}
 
-        if (apu->global_counter % SAMPLE_RATE == 0) {
-            u8 ch1_sample = apu->ch1_enable ? get_sample_ch1(apu) : 0;
-            u8 ch2_sample = apu->ch2_enable ? get_sample_ch2(apu) : 0;
-            u8 ch3_sample = apu->ch3_enable ? get_sample_ch3(apu) : 0;
-            u8 ch4_sample = apu->ch4_enable ? get_sample_ch4(apu) : 0;
-            apu->master->io[PCM12] = ch1_sample | (ch2_sample << 4);
-            apu->master->io[PCM34] = ch3_sample | (ch4_sample << 4);
-
-            u8 l_sample = 0, r_sample = 0;
-            if (apu->master->io[NR51] & (1 << 0)) r_sample += ch1_sample;
-            if (apu->master->io[NR51] & (1 << 1)) r_sample += ch2_sample;
-            if (apu->master->io[NR51] & (1 << 2)) r_sample += ch3_sample;
-            if (apu->master->io[NR51] & (1 << 3)) r_sample += ch4_sample;
-            if (apu->master->io[NR51] & (1 << 4)) l_sample += ch1_sample;
-            if (apu->master->io[NR51] & (1 << 5)) l_sample += ch2_sample;
-            if (apu->master->io[NR51] & (1 << 6)) l_sample += ch3_sample;
-            if (apu->master->io[NR51] & (1 << 7)) l_sample += ch4_sample;
-
-            apu->sample_buf[apu->buf_ind%2][apu->sample_ind++] =
-                (float) l_sample / 500 *
-                (((apu->master->io[NR50] & 0b01110000) >> 4) + 1);
-            apu->sample_buf[apu->buf_ind%2][apu->sample_ind++] =
-                (float) r_sample / 500 *
-                ((apu->master->io[NR50] & 0b00000111) + 1);
-            if (apu->sample_ind == SAMPLE_BUF_LEN) {
-                apu->samples_full = true;
-                apu->sample_ind = 0;
-                apu->buf_ind++;
-            }
+static void step_channels(struct gb_apu* apu, long from, long to) {
+    step_wave(apu, 0, &apu->ch1_counter, apu->ch1_wavelen,
+              &apu->ch1_duty_index, from, to, 4);
+    step_wave(apu, 1, &apu->ch2_counter, apu->ch2_wavelen,
+              &apu->ch2_duty_index, from, to, 4);
+    step_wave(apu, 2, &apu->ch3_counter, apu->ch3_wavelen,
+              &apu->ch3_sample_index, from, to, 2);
+    step_noise(apu, from, to);
+}
+
+/*
+runs the channels for n clocks. the pulse channels step every 4 clocks, the
+wave channel every 2 and the noise channel every 8, each independent of the
+others, so every channel is stepped in one go up to the next point sample,
+or over the whole span on the band-limited path or when nothing is mixed
+*/
+static void run_channels(struct gb_apu* apu, long n) {
+    if (apu->sample_rate || !mixing(apu)) {
+        long from = apu->global_counter;
+        apu->blip_base = apu->blip_clock - from;
+        step_channels(apu, from, from + n);
+        apu->global_counter += n;
+        apu->blip_clock += n;
+    } else {
+        while (n > 0) {
+            long from = apu->global_counter;
+            long to = from + SAMPLE_RATE - from % SAMPLE_RATE;
+            if (to > from + n) to = from + n;
+            step_channels(apu, from, to);
+            apu->global_counter = to;
+            n -= to - from;
+            if (to % SAMPLE_RATE == 0) take_sample(apu);
         }
     }
 
-    u16 effective_apu_div_rate = APU_DIV_RATE;
-    if (apu->master->io[KEY1] & (1 << 7)) effective_apu_div_rate <<= 1;
-    if (apu->master->div % effective_apu_div_rate == 0) {
-        apu->apu_div++;
-
-        if (apu->apu_div % 2 == 0) {
-            if (apu->master->io[NR14] & NRX4_LEN_ENABLE) {
-                apu->ch1_len_counter++;
-                if (apu->ch1_len_counter == 64) {
-                    apu->ch1_len_counter = 0;
-                    apu->ch1_enable = false;
-                }
+    // the same whichever way the output is made, so skipping it can not
+    // change what the cpu sees
+    u8 ch1_sample = apu->ch1_enable ? get_sample_ch1(apu) : 0;
+    u8 ch2_sample = apu->ch2_enable ? get_sample_ch2(apu) : 0;
+    u8 ch3_sample = apu->ch3_enable ? get_sample_ch3(apu) : 0;
+    u8 ch4_sample = apu->ch4_enable ? get_sample_ch4(apu) : 0;
+    apu->master->io[PCM12] = ch1_sample | (ch2_sample << 4);
+    apu->master->io[PCM34] = ch3_sample | (ch4_sample << 4);
+}
+
+static void clock_frame_sequencer(struct gb_apu* apu) {
+    apu->apu_div++;
+
+    if (apu->apu_div % 2 == 0) {
+        if (apu->master->io[NR14] & NRX4_LEN_ENABLE) {
+            apu->ch1_len_counter++;
+            if (apu->ch1_len_counter == 64) {
+                apu->ch1_len_counter = 0;
+                apu->ch1_enable = false;
             }
+        }
 
-            if (apu->master->io[NR24] & NRX4_LEN_ENABLE) {
-                apu->ch2_len_counter++;
-                if (apu->ch2_len_counter == 64) {
-                    apu->ch2_len_counter = 0;
-                    apu->ch2_enable = false;
-                }
+        if (apu->master->io[NR24] & NRX4_LEN_ENABLE) {
+            apu->ch2_len_counter++;
+            if (apu->ch2_len_counter == 64) {
+                apu->ch2_len_counter = 0;
+                apu->ch2_enable = false;
             }
+        }
 
-            if (apu->master->io[NR34] & NRX4_LEN_ENABLE) {
-                apu->ch3_len_counter++;
-                if (apu->ch3_len_counter == 0) {
-                    apu->ch3_enable = false;
-                }
+        if (apu->master->io[NR34] & NRX4_LEN_ENABLE) {
+            apu->ch3_len_counter++;
+            if (apu->ch3_len_counter == 0) {
+                apu->ch3_enable = false;
             }
+        }
 
-            if (apu->master->io[NR44] & NRX4_LEN_ENABLE) {
-                apu->ch4_len_counter++;
-                if (apu->ch4_len_counter == 64) {
-                    apu->ch4_len_counter = 0;
-                    apu->ch4_enable = false;
-                }
+        if (apu->master->io[NR44] & NRX4_LEN_ENABLE) {
+            apu->ch4_len_counter++;
+            if (apu->ch4_len_counter == 64) {
+                apu->ch4_len_counter = 0;
+                apu->ch4_enable = false;
             }
         }
-        if (apu->apu_div % 4 == 0) {
-            apu->ch1_sweep_counter++;
-            if (apu->ch1_sweep_pace &&
-                apu->ch1_sweep_counter == apu->ch1_sweep_pace) {
-                apu->ch1_sweep_counter = 0;
-                apu->ch1_sweep_pace = (apu->master->io[NR10] & NR10_PACE) >> 4;
-                u16 del_wvlen =
-                    apu->ch1_wavelen >> (apu->master->io[NR10] & NR10_SLOP);
-                u16 new_wvlen = apu->ch1_wavelen;
-                if (apu->master->io[NR10] & NR10_DIR) {
-                    new_wvlen -= del_wvlen;
-                } else {
-                    new_wvlen += del_wvlen;
-                    if (new_wvlen > 2047) apu->ch1_enable = false;
-                }
-                if (apu->master->io[NR10] & NR10_SLOP)
-                    apu->ch1_wavelen = new_wvlen;
+    }
+    if (apu->apu_div % 4 == 0) {
+        apu->ch1_sweep_counter++;
+        if (apu->ch1_sweep_pace &&
+            apu->ch1_sweep_counter == apu->ch1_sweep_pace) {
+            apu->ch1_sweep_counter = 0;
+            apu->ch1_sweep_pace = (apu->master->io[NR10] & NR10_PACE) >> 4;
+            u16 del_wvlen =
+                apu->ch1_wavelen >> (apu->master->io[NR10] & NR10_SLOP);
+            u16 new_wvlen = apu->ch1_wavelen;
+            if (apu->master->io[NR10] & NR10_DIR) {
+                new_wvlen -= del_wvlen;
+            } else {
+                new_wvlen += del_wvlen;
+                if (new_wvlen > 2047) apu->ch1_enable = false;
             }
+            if (apu->master->io[NR10] & NR10_SLOP)
+                apu->ch1_wavelen = new_wvlen;
         }
-        if (apu->apu_div % 8 == 0) {
-            apu->ch1_env_counter++;
-            if (apu->ch1_env_pace &&
-                apu->ch1_env_counter == apu->ch1_env_pace) {
-                apu->ch1_env_counter = 0;
-                if (apu->ch1_env_dir) {
-                    apu->ch1_volume++;
-                    if (apu->ch1_volume == 0x10) apu->ch1_volume = 0xf;
-                } else {
-                    apu->ch1_volume--;
-                    if (apu->ch1_volume == 0xff) apu->ch1_volume = 0x0;
-                }
+    }
+    if (apu->apu_div % 8 == 0) {
+        apu->ch1_env_counter++;
+        if (apu->ch1_env_pace &&
+            apu->ch1_env_counter == apu->ch1_env_pace) {
+            apu->ch1_env_counter = 0;
+            if (apu->ch1_env_dir) {
+                apu->ch1_volume++;
+                if (apu->ch1_volume == 0x10) apu->ch1_volume = 0xf;
+            } else {
+                apu->ch1_volume--;
+                if (apu->ch1_volume == 0xff) apu->ch1_volume = 0x0;
             }
+        }
 
-            apu->ch2_env_counter++;
-            if (apu->ch2_env_pace &&
-                apu->ch2_env_counter == apu->ch2_env_pace) {
-                apu->ch2_env_counter = 0;
-                if (apu->ch2_env_dir) {
-                    apu->ch2_volume++;
-                    if (apu->ch2_volume == 0x10) apu->ch2_volume = 0xf;
-                } else {
-                    apu->ch2_volume--;
-                    if (apu->ch2_volume == 0xff) apu->ch2_volume = 0x0;
-                }
+        apu->ch2_env_counter++;
+        if (apu->ch2_env_pace &&
+            apu->ch2_env_counter == apu->ch2_env_pace) {
+            apu->ch2_env_counter = 0;
+            if (apu->ch2_env_dir) {
+                apu->ch2_volume++;
+                if (apu->ch2_volume == 0x10) apu->ch2_volume = 0xf;
+            } else {
+                apu->ch2_volume--;
+                if (apu->ch2_volume == 0xff) apu->ch2_volume = 0x0;
             }
+        }
 
-            apu->ch4_env_counter++;
-            if (apu->ch4_env_pace &&
-                apu->ch4_env_counter == apu->ch4_env_pace) {
-                apu->ch4_env_counter = 0;
-                if (apu->ch4_env_dir) {
-                    apu->ch4_volume++;
-                    if (apu->ch4_volume == 0x10) apu->ch4_volume = 0xf;
-                } else {
-                    apu->ch4_volume--;
-                    if (apu->ch4_volume == 0xff) apu->ch4_volume = 0x0;
-                }
+        apu->ch4_env_counter++;
+        if (apu->ch4_env_pace &&
+            apu->ch4_env_counter == apu->ch4_env_pace) {
+            apu->ch4_env_counter = 0;
+            if (apu->ch4_env_dir) {
+                apu->ch4_volume++;
+                if (apu->ch4_volume == 0x10) apu->ch4_volume = 0xf;
+            } else {
+                apu->ch4_volume--;
+                if (apu->ch4_volume == 0xff) apu->ch4_volume = 0x0;
             }
         }
     }
 }
+
+// how many of the div values met counting n t-cycles up from div 0 are
+// multiples of speed. div wraps every 0x10000 t-cycles, which speeds that are
+// not a power of two do not divide
+static u64 div_multiples(u64 n, int speed) {
+    return n / 0x10000 * (0xffff / speed + 1) +
+           (n % 0x10000 + speed - 1) / speed;
+}
+
+// runs the channels up to the given t-cycle
+void apu_sync(struct gb_apu* apu, u64 time) {
+    if (time <= apu->sync_time) return;
+    u64 from = apu->sync_time;
+    apu->sync_time = time;
+
+    // the channels are clocked on t-cycles where div is a multiple of the
+    // effective speed
+    int effective_speed = apu->master->cfg.speed;
+    if (apu->master->io[KEY1] & (1 << 7)) effective_speed *= 2;
+    u64 start = get_div(apu->master, from + 1);
+    long clocks = div_multiples(start + (time - from), effective_speed) -
+                  div_multiples(start, effective_speed);
+
+    if (!(apu->master->io[NR52] & 0b10000000)) {
+        apu->master->io[NR52] = 0;
+        apu->apu_div = 0;
+        apu->sample_ind = 0;
+        apu->global_counter = 0;
+        apu->blip_clock += clocks;
+        return;
+    }
+
+    apu->master->io[NR52] = 0b10000000 | (apu->ch1_enable ? 0b0001 : 0) |
+                            (apu->ch2_enable ? 0b0010 : 0) |
+                            (apu->ch3_enable ? 0b0100 : 0) |
+                            (apu->ch4_enable ? 0b1000 : 0);
+    run_channels(apu, clocks);
+}
+
+// switches to band-limited output at the given rate, or back to point
+// sampling into sample_buf if it is 0
+void apu_set_sample_rate(struct gb_apu* apu, long sample_rate) {
+    apu->sample_rate = sample_rate;
+    if (!sample_rate) return;
+    blip_init(&apu->blip[0], GB_CLOCK_FREQ, sample_rate);
+    blip_init(&apu->blip[1], GB_CLOCK_FREQ, sample_rate);
+    apu->blip_clock = 0;
+    memset(apu->out_amp, 0, sizeof apu->out_amp);
+    apu_update_outputs(apu);
+}
+
+// call after anything changes the channel outputs outside of apu_sync, with
+// the apu synced to now
+void apu_update_outputs(struct gb_apu* apu) {
+    if (!apu->sample_rate) return;
+    apu->blip_base = apu->blip_clock - apu->global_counter;
+    for (int i = 0; i < 4; i++) update_output(apu, i, apu->global_counter);
+}
+
+// stretches the output by ratio, for a frontend to nudge how many samples it
+// gets towards what its audio device actually consumes
+void apu_set_rate_ratio(struct gb_apu* apu, double ratio) {
+    if (!apu->sample_rate) return;
+    blip_set_rates(&apu->blip[0], GB_CLOCK_FREQ, apu->sample_rate * ratio);
+    blip_set_rates(&apu->blip[1], GB_CLOCK_FREQ, apu->sample_rate * ratio);
+}
+
+// makes the output up to where the apu is synced readable
+void apu_end_frame(struct gb_apu* apu) {
+    if (!apu->sample_rate) return;
+    blip_end_frame(&apu->blip[0], apu->blip_clock);
+    blip_end_frame(&apu->blip[1], apu->blip_clock);
+    apu->blip_clock = 0;
+}
+
+// reads up to count stereo samples of band-limited output, interleaved and
+// at the same scale as sample_buf. returns the number read
+int apu_read_samples(struct gb_apu* apu, float* out, int count) {
+    if (!apu->sample_rate) return 0;
+    int n = blip_read_samples(&apu->blip[0], out, count, 2, 1.0f / 500);
+    blip_read_samples(&apu->blip[1], out ? out + 1 : NULL, n, 2, 1.0f / 500);
+    return n;
+}
+
+// schedules the frame sequencer step after the given t-cycle
+void apu_schedule(struct gb_apu* apu, u64 time) {
+    u64 rate = APU_DIV_RATE;
+    if (apu->master->io[KEY1] & (1 << 7)) rate <<= 1;
+    sched_add(&apu->master->sched, EV_APU,
+              time + rate - get_div(apu->master, time) % rate);
+}
+
+void apu_event(struct gb_apu* apu, u64 time) {
+    apu_sync(apu, time);
+    if (apu->master->io[NR52] & 0b10000000) {
+        clock_frame_sequencer(apu);
+        apu_update_outputs(apu);
+    }
+    apu_schedule(apu, time);
+}
@@ -1,12 +1,14 @@
 #ifndef APU_H
 #define APU_H
 
+#include "blip.h"
+#include "ppu.h"
 #include "types.h"
 
 #define APU_DIV_RATE 8192
 
 #define SAMPLE_FREQ 44100
-#define SAMPLE_RATE ((1 << 22) / SAMPLE_FREQ)
+#define SAMPLE_RATE (GB_CLOCK_FREQ / SAMPLE_FREQ)
 #define SAMPLE_BUF_LEN 1024
 
 enum { NRX1_LEN = 0b00111111, NRX1_DUTY = 0b11000000 };
@@ -33,7 +35,6 @@ struct gb_apu {
     float sample_buf[2][SAMPLE_BUF_LEN];
     int sample_ind;
     int buf_ind;
-    bool samples_full;
 
     long global_counter;
 
@@ -73,8 +74,26 @@ struct gb_apu {
     bool ch4_env_dir;
     u8 ch4_volume;
     u8 ch4_len_counter;
+
+    u64 sync_time;
+
+    // band-limited output at sample_rate, used instead of sample_buf when
+    // sample_rate is set. blip_clock counts channel clocks in the current
+    // output frame and blip_base maps global_counter onto it
+    long sample_rate;
+    struct blip blip[2];
+    long blip_clock;
+    long blip_base;
+    int out_amp[4][2];
 };
 
-void apu_clock(struct gb_apu* apu);
+void apu_sync(struct gb_apu* apu, u64 time);
+void apu_set_sample_rate(struct gb_apu* apu, long sample_rate);
+void apu_update_outputs(struct gb_apu* apu);
+void apu_set_rate_ratio(struct gb_apu* apu, double ratio);
+void apu_end_frame(struct gb_apu* apu);
+int apu_read_samples(struct gb_apu* apu, float* out, int count);
+void apu_schedule(struct gb_apu* apu, u64 time);
+void apu_event(struct gb_apu* apu, u64 time);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include "battery.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// through a temp file of its own next to the save, so writers of the same
+// save never write into each other's temp file
+static bool write_file(struct battery* b) {
+    strcpy(b->tmp_filename + strlen(b->filename), ".XXXXXX");
+    int fd = mkstemp(b->tmp_filename);
+    if (fd < 0) return false;
+    // mkstemp leaves it readable by the owner only
+    fchmod(fd, 0644);
+    FILE* fp = fdopen(fd, "wb");
+    if (!fp) {
+        close(fd);
+        remove(b->tmp_filename);
+        return false;
+    }
+    bool ok = fwrite(b->out, 1, b->size, fp) == b->size && !fflush(fp) &&
+              !fsync(fileno(fp));
+    ok &= !fclose(fp);
+    if (ok) ok = !rename(b->tmp_filename, b->filename);
+    if (!ok) remove(b->tmp_filename);
+    return ok;
+}
+
+static void* battery_thread(void* arg) {
+    struct battery* b = arg;
+    pthread_mutex_lock(&b->lock);
+    while (true) {
+        if (!b->quit) {
+            if (b->interval_ms) {
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                long ns = ts.tv_nsec + (b->interval_ms % 1000) * 1000000L;
+                ts.tv_sec += b->interval_ms / 1000 + ns / 1000000000;
+                ts.tv_nsec = ns % 1000000000;
+                pthread_cond_timedwait(&b->cond, &b->lock, &ts);
+            } else {
+                pthread_cond_wait(&b->cond, &b->lock);
+            }
+        }
+        if (b->pending) {
+            memcpy(b->out, b->staged, b->size);
+            b->pending = false;
+            pthread_mutex_unlock(&b->lock);
+            bool ok = write_file(b);
+            pthread_mutex_lock(&b->lock);
+            // tried again next time, and only reported the first time
+            if (!ok) {
+                if (!b->failing) {
+                    fprintf(stderr, "error writing save %s, retrying\n",
+                            b->filename);
+                }
+                b->failing = true;
+                b->pending = true;
+            } else if (b->failing) {
+                fprintf(stderr, "wrote save %s\n", b->filename);
+                b->failing = false;
+            }
+        }
+        if (b->quit) {
+            if (b->pending) {
+                fprintf(stderr, "error writing save %s, changes lost\n",
+                        b->filename);
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&b->lock);
+    return NULL;
+}
+
+// loads the save into data, zero filling whatever the file is missing, and
+// starts the writer
+bool battery_open(struct battery* b, char* filename, u8* data, size_t size) {
+    memset(b, 0, sizeof *b);
+    b->filename = filename;
+    b->tmp_filename = malloc(strlen(filename) + 8);
+    b->staged = calloc(1, size);
+    b->out = malloc(size);
+    if (!b->tmp_filename || !b->staged || !b->out) {
+        free(b->tmp_filename);
+        free(b->staged);
+        free(b->out);
+        return false;
+    }
+    strcpy(b->tmp_filename, filename);
+    b->size = size;
+    b->interval_ms = BATTERY_FLUSH_MS;
+
+    FILE* fp = fopen(filename, "rb");
+    if (fp) {
+        size_t n = fread(b->staged, 1, size, fp);
+        fclose(fp);
+        // a short file is padded out on the first write back
+        if (n < size) b->pending = true;
+    } else if (errno == ENOENT) {
+        b->pending = true;
+    }
+    memcpy(data, b->staged, size);
+
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_cond_init(&b->cond, NULL);
+    if (pthread_create(&b->thread, NULL, battery_thread, b)) {
+        pthread_mutex_destroy(&b->lock);
+        pthread_cond_destroy(&b->cond);
+        free(b->tmp_filename);
+        free(b->staged);
+        free(b->out);
+        return false;
+    }
+    return true;
+}
+
+// writes out anything still staged
+void battery_close(struct battery* b) {
+    pthread_mutex_lock(&b->lock);
+    b->quit = true;
+    pthread_cond_signal(&b->cond);
+    pthread_mutex_unlock(&b->lock);
+    pthread_join(b->thread, NULL);
+    pthread_mutex_destroy(&b->lock);
+    pthread_cond_destroy(&b->cond);
+    free(b->tmp_filename);
+    free(b->staged);
+    free(b->out);
+}
+
+void battery_set_interval(struct battery* b, int interval_ms) {
+    pthread_mutex_lock(&b->lock);
+    b->interval_ms = interval_ms;
+    pthread_cond_signal(&b->cond);
+    pthread_mutex_unlock(&b->lock);
+}
+
+// call from the thread that owns data, with a bit set for each chunk that
+// may have changed. only chunks that differ from what is staged are copied
+void battery_stage(struct battery* b, const u8* data, u32 dirty) {
+    for (int i = 0; dirty && i * BATTERY_CHUNK < b->size; i++, dirty >>= 1) {
+        if (!(dirty & 1)) continue;
+        size_t start = i * BATTERY_CHUNK;
+        size_t len = b->size - start;
+        if (len > BATTERY_CHUNK) len = BATTERY_CHUNK;
+        if (!memcmp(b->staged + start, data + start, len)) continue;
+        pthread_mutex_lock(&b->lock);
+        memcpy(b->staged + start, data + start, len);
+        b->pending = true;
+        pthread_mutex_unlock(&b->lock);
+    }
+}
\ No newline at end of file
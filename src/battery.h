@@ -0,0 +1,48 @@
+#ifndef BATTERY_H
+#define BATTERY_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "types.h"
+
+// how often changed battery ram is written back by default
+#define BATTERY_FLUSH_MS 2000
+// granularity of the change tracking, the size of a cart ram bank
+#define BATTERY_CHUNK 0x2000
+
+/*
+write back of a battery save file. the save lives in memory the caller owns,
+and after each frame the caller hands over a mask of the 8k chunks that may
+have changed. those that really did are copied into staged, an image of the
+file, and a thread writes that out every interval_ms (never if 0) and on
+close. it goes to a temp file of its own that is renamed over the save, so
+a crash or another writer of the same save leaves either a whole old save or
+a whole new one
+*/
+struct battery {
+    char* filename;
+    // filename with a suffix that mkstemp fills in
+    char* tmp_filename;
+    size_t size;
+    int interval_ms;
+
+    // staged is only written by the caller's thread, under lock
+    u8* staged;
+    u8* out;
+    bool pending;
+    // the last write failed
+    bool failing;
+    bool quit;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+bool battery_open(struct battery* b, char* filename, u8* data, size_t size);
+void battery_close(struct battery* b);
+void battery_set_interval(struct battery* b, int interval_ms);
+void battery_stage(struct battery* b, const u8* data, u32 dirty);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,437 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cartridge.h"
+#include "gb.h"
+#include "ppu.h"
+#include "profile.h"
+#include "rewind.h"
+#include "sm83.h"
+
+#define BENCH_ROM_SIZE (2 * ROM_BANK_SIZE)
+
+enum {
+    W_LCD = 1 << 0,
+    W_CGB = 1 << 1,
+    W_HDMA = 1 << 2,
+    W_AUDIO = 1 << 3,
+    // same rom, run with render_skip
+    W_SKIP = 1 << 4,
+    // same rom, snapshotting for rewind every frame
+    W_REWIND = 1 << 5,
+};
+
+struct workload {
+    char* name;
+    int flags;
+    char* rom_filename;
+};
+
+static struct workload workloads[] = {
+    {"dmg", W_LCD},
+    {"cgb", W_LCD | W_CGB},
+    {"lcd-off", 0},
+    {"hdma", W_LCD | W_CGB | W_HDMA},
+    {"audio", W_LCD | W_AUDIO},
+    {"skip", W_LCD | W_AUDIO | W_SKIP},
+    {"rewind", W_LCD | W_AUDIO | W_REWIND},
+};
+#define N_WORKLOADS (sizeof workloads / sizeof workloads[0])
+
+/*
+built in workload roms are assembled here so the benchmark does not depend on
+any rom files. they are loosely modelled on a game: set up tiles, maps,
+sprites and palettes with the lcd off, then each frame wait for vblank, do an
+oam dma, read the joypad, scroll and move sprites, and burn some cycles on
+game logic.
+*/
+
+struct rom_asm {
+    u8* rom;
+    u16 pc;
+};
+
+static void emit(struct rom_asm* a, const u8* bytes, int n) {
+    memcpy(&a->rom[a->pc], bytes, n);
+    a->pc += n;
+}
+
+#define OP(a, ...)                                                             \
+    emit(a, (const u8[]){__VA_ARGS__}, sizeof((const u8[]){__VA_ARGS__}))
+
+// displacement for a 2 byte relative jump emitted at the current pc
+static u8 rel(struct rom_asm* a, u16 target) {
+    return target - (a->pc + 2);
+}
+
+static void asm_memcpy(struct rom_asm* a, u16 dst, u16 src, u16 len) {
+    OP(a, 0x21, src & 0xff, src >> 8); // ld hl, src
+    OP(a, 0x11, dst & 0xff, dst >> 8); // ld de, dst
+    OP(a, 0x01, len & 0xff, len >> 8); // ld bc, len
+    u16 loop = a->pc;
+    OP(a, 0x2a, 0x12, 0x13, 0x0b); // ld a, (hl+); ld (de), a; inc de; dec bc
+    OP(a, 0x78, 0xb1);             // ld a, b; or c
+    OP(a, 0x20, rel(a, loop));     // jr nz, loop
+}
+
+static void build_rom(u8* rom, int flags) {
+    memset(rom, 0, BENCH_ROM_SIZE);
+
+    // bank 1 holds tile data and attributes, palettes at 0x7800 and an oam
+    // image at 0x7900
+    u32 seed = 0x12345678;
+    for (int i = 0x4000; i < 0x8000; i++) {
+        seed = seed * 1103515245 + 12345;
+        rom[i] = seed >> 16;
+    }
+    for (int i = 0; i < 40; i++) {
+        rom[0x7900 + 4 * i] = 16 + (i * 37) % 144;
+        rom[0x7900 + 4 * i + 1] = 8 + (i * 53) % 160;
+    }
+
+    memcpy(&rom[0x0134], "GBEMU BENCH", 11);
+    if (flags & W_CGB) rom[0x0143] = 0x80;
+
+    struct rom_asm a = {rom, 0x0040};
+    // vblank: oam dma from 0xc000 and wait for it to finish
+    OP(&a, 0xf5, 0x3e, 0xc0, 0xe0, DMA); // push af; ld a, 0xc0; ldh (DMA), a
+    OP(&a, 0x3e, 0x28);                  // ld a, 40
+    OP(&a, 0x3d, 0x20, 0xfd);            // dec a; jr nz, -3
+    OP(&a, 0xf1, 0xd9);                  // pop af; reti
+
+    a.pc = 0x0100;
+    OP(&a, 0x00, 0xc3, 0x50, 0x01); // nop; jp 0x0150
+
+    a.pc = 0x0150;
+    OP(&a, 0xf3, 0x31, 0xfe, 0xff); // di; ld sp, 0xfffe
+    u16 wait = a.pc;
+    OP(&a, 0xf0, LY, 0xfe, 0x90); // ldh a, (LY); cp 144
+    OP(&a, 0x20, rel(&a, wait));  // jr nz, wait
+    OP(&a, 0xaf, 0xe0, LCDC);     // xor a; ldh (LCDC), a
+
+    if (flags & W_LCD) {
+        asm_memcpy(&a, 0x8000, 0x4000, 0x1800);
+        OP(&a, 0x21, 0x00, 0x98); // ld hl, 0x9800
+        OP(&a, 0x01, 0x00, 0x08); // ld bc, 0x800
+        u16 map = a.pc;
+        OP(&a, 0x7d, 0x22, 0x0b); // ld a, l; ld (hl+), a; dec bc
+        OP(&a, 0x78, 0xb1);       // ld a, b; or c
+        OP(&a, 0x20, rel(&a, map)); // jr nz, map
+        asm_memcpy(&a, 0xfe00, 0x7900, OAM_SIZE);
+        asm_memcpy(&a, 0xc000, 0x7900, OAM_SIZE);
+
+        if (flags & W_CGB) {
+            OP(&a, 0x3e, 0x01, 0xe0, VBK); // ld a, 1; ldh (VBK), a
+            asm_memcpy(&a, 0x8000, 0x6000, 0x1800);
+            asm_memcpy(&a, 0x9800, 0x5800, 0x0800);
+            OP(&a, 0xaf, 0xe0, VBK); // xor a; ldh (VBK), a
+
+            OP(&a, 0x3e, 0x80);             // ld a, 0x80
+            OP(&a, 0xe0, BCPS, 0xe0, OCPS); // ldh (BCPS), a; ldh (OCPS), a
+            OP(&a, 0x21, 0x00, 0x78);       // ld hl, 0x7800
+            OP(&a, 0x06, 0x40);             // ld b, 64
+            u16 pal = a.pc;
+            OP(&a, 0x2a, 0xe0, BCPD); // ld a, (hl+); ldh (BCPD), a
+            OP(&a, 0x2a, 0xe0, OCPD); // ld a, (hl+); ldh (OCPD), a
+            OP(&a, 0x05, 0x20, rel(&a, pal)); // dec b; jr nz, pal
+        }
+
+        OP(&a, 0x3e, 0xe4, 0xe0, BGP);  // ld a, 0xe4; ldh (BGP), a
+        OP(&a, 0x3e, 0xd2, 0xe0, OBP0); // ld a, 0xd2; ldh (OBP0), a
+        OP(&a, 0x3e, 0x1b, 0xe0, OBP1); // ld a, 0x1b; ldh (OBP1), a
+        OP(&a, 0x3e, 0x50, 0xe0, WY);   // ld a, 80; ldh (WY), a
+        OP(&a, 0x3e, 0x30, 0xe0, WX);   // ld a, 48; ldh (WX), a
+    }
+
+    if (flags & W_AUDIO) {
+        static const u8 audio_init[][2] = {
+            {NR52, 0x80}, {NR50, 0x77}, {NR51, 0xff}, {NR10, 0x15},
+            {NR11, 0x80}, {NR12, 0xf3}, {NR21, 0x40}, {NR22, 0xf2},
+            {NR30, 0x80}, {NR32, 0x20}, {NR42, 0xf1}, {NR43, 0x35},
+        };
+        for (int i = 0; i < sizeof audio_init / sizeof audio_init[0]; i++) {
+            OP(&a, 0x3e, audio_init[i][1], 0xe0, audio_init[i][0]);
+        }
+        for (int i = 0; i < 0x10; i++) {
+            OP(&a, 0x3e, (i * 0x1f) & 0xff, 0xe0, WAVERAM + i);
+        }
+    }
+
+    if (flags & W_LCD) {
+        OP(&a, 0x3e, I_VBLANK, 0xe0, 0xff); // ld a, I_VBLANK; ldh (IE), a
+        OP(&a, 0xaf, 0xe0, IF);             // xor a; ldh (IF), a
+        OP(&a, 0x3e, 0xe7, 0xe0, LCDC);     // ld a, 0xe7; ldh (LCDC), a
+        OP(&a, 0xfb);                       // ei
+    }
+
+    u16 main = a.pc;
+    if (flags & W_LCD) OP(&a, 0x76); // halt
+
+    // joypad directions scroll x, buttons scroll y
+    OP(&a, 0x3e, 0x20, 0xe0, JOYP); // ld a, 0x20; ldh (JOYP), a
+    OP(&a, 0xf0, JOYP, 0xf0, JOYP); // ldh a, (JOYP) x2
+    OP(&a, 0x2f, 0xe6, 0x0f, 0x47); // cpl; and 0x0f; ld b, a
+    OP(&a, 0xf0, SCX, 0x80, 0xe0, SCX); // ldh a, (SCX); add b; ldh (SCX), a
+    OP(&a, 0x3e, 0x10, 0xe0, JOYP); // ld a, 0x10; ldh (JOYP), a
+    OP(&a, 0xf0, JOYP, 0xf0, JOYP); // ldh a, (JOYP) x2
+    OP(&a, 0x2f, 0xe6, 0x0f, 0x47); // cpl; and 0x0f; ld b, a
+    OP(&a, 0xf0, SCY, 0x80, 0xe0, SCY); // ldh a, (SCY); add b; ldh (SCY), a
+    OP(&a, 0x3e, 0x30, 0xe0, JOYP); // ld a, 0x30; ldh (JOYP), a
+
+    // move every sprite in the shadow oam one pixel right
+    OP(&a, 0x21, 0x01, 0xc0, 0x0e, 40); // ld hl, 0xc001; ld c, 40
+    u16 move = a.pc;
+    OP(&a, 0x34, 0x23, 0x23, 0x23, 0x23); // inc (hl); inc hl x4
+    OP(&a, 0x0d, 0x20, rel(&a, move));    // dec c; jr nz, move
+
+    // frame counter in 0xc100
+    OP(&a, 0xfa, 0x00, 0xc1); // ld a, (0xc100)
+    OP(&a, 0x3c);             // inc a
+    OP(&a, 0xea, 0x00, 0xc1); // ld (0xc100), a
+
+    if (flags & W_AUDIO) {
+        // retrigger every channel with the frame counter as the frequency
+        OP(&a, 0xe0, NR13, 0x3e, 0x86, 0xe0, NR14);
+        OP(&a, 0x2f, 0xe0, NR23, 0x3e, 0x85, 0xe0, NR24);
+        OP(&a, 0xe0, NR33, 0x3e, 0x87, 0xe0, NR34);
+        OP(&a, 0x3e, 0x80, 0xe0, NR44);
+    }
+
+    if (flags & W_HDMA) {
+        // general purpose transfer of 1k, then a hblank transfer of 2k
+        OP(&a, 0x3e, 0x40, 0xe0, HDMA1); // from 0x4000
+        OP(&a, 0xaf, 0xe0, HDMA2);
+        OP(&a, 0x3e, 0x08, 0xe0, HDMA3); // to 0x8800
+        OP(&a, 0xaf, 0xe0, HDMA4);
+        OP(&a, 0x3e, 0x3f, 0xe0, HDMA5);
+        OP(&a, 0x3e, 0x50, 0xe0, HDMA1); // from 0x5000
+        OP(&a, 0x3e, 0x10, 0xe0, HDMA3); // to 0x9000
+        OP(&a, 0x3e, 0xff, 0xe0, HDMA5);
+    }
+
+    // game logic: copy a block of wram
+    asm_memcpy(&a, 0xd000, 0xc000, (flags & W_LCD) ? 0x0200 : 0x0800);
+
+    OP(&a, 0xc3, main & 0xff, main >> 8); // jp main
+}
+
+static double get_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// same input every run: cycle through each button for 16 frames
+static void scripted_input(struct gb* gb, unsigned long frame) {
+    int button = (frame / 16) % 9;
+    gb->jp_dir = 0;
+    gb->jp_action = 0;
+    if (button > 0 && button <= 4) gb->jp_dir = 1 << (button - 1);
+    else if (button > 4) gb->jp_action = 1 << (button - 5);
+    gb_update_input(gb);
+}
+
+struct bench_result {
+    unsigned long frames;
+    u64 cycles;
+    double time;
+    unsigned long samples[PROF_MAX];
+};
+
+static bool run_workload(struct workload* w, unsigned long frames,
+                         struct bench_result* res) {
+    char* filename = w->rom_filename;
+    char tmp_filename[] = "/tmp/gbemu-bench-XXXXXX.gb";
+    if (!filename) {
+        u8* rom = malloc(BENCH_ROM_SIZE);
+        build_rom(rom, w->flags);
+        int fd = mkstemps(tmp_filename, 3);
+        if (fd < 0) {
+            free(rom);
+            return false;
+        }
+        bool ok = write(fd, rom, BENCH_ROM_SIZE) == BENCH_ROM_SIZE;
+        close(fd);
+        free(rom);
+        if (!ok) {
+            unlink(tmp_filename);
+            return false;
+        }
+        filename = tmp_filename;
+    }
+    struct cartridge* cart = cart_create(filename);
+    if (!w->rom_filename) unlink(tmp_filename);
+    if (!cart) return false;
+
+    struct gb* gb = malloc(sizeof *gb);
+    init_gb_config(&gb->cfg);
+    if (w->flags & W_SKIP) gb->cfg.render_skip = SKIP_VIDEO | SKIP_AUDIO;
+    reset_gb(gb, cart);
+    struct rewind rw;
+    bool rewind = w->flags & W_REWIND;
+    if (rewind && !rewind_init(&rw, gb, 1, 64 << 20)) {
+        free(gb);
+        cart_destroy(cart);
+        return false;
+    }
+
+    prof_start(100);
+    double start = get_time();
+    for (res->frames = 0; res->frames < frames && !gb->cpu.ill;
+         res->frames++) {
+        if (rewind) rewind_frame(&rw);
+        scripted_input(gb, res->frames);
+        gb_run_frame(gb);
+        gb_end_frame(gb);
+    }
+    res->time = get_time() - start;
+    prof_stop();
+    if (rewind) rewind_free(&rw);
+
+    res->cycles = gb->cycles;
+    for (int i = 0; i < PROF_MAX; i++) res->samples[i] = prof_samples[i];
+
+    free(gb);
+    cart_destroy(cart);
+    return true;
+}
+
+// writes each distinct built in rom to dir as name.gb, for runs outside the
+// benchmark such as the movie checks
+static bool export_roms(char* dir) {
+    u8* rom = malloc(BENCH_ROM_SIZE);
+    if (!rom) return false;
+    bool ok = true;
+    for (int i = 0; i < N_WORKLOADS && ok; i++) {
+        struct workload* w = &workloads[i];
+        if (w->flags & (W_SKIP | W_REWIND)) continue;
+        build_rom(rom, w->flags);
+        char filename[4096];
+        snprintf(filename, sizeof filename, "%s/%s.gb", dir, w->name);
+        FILE* file = fopen(filename, "wb");
+        ok = file && fwrite(rom, 1, BENCH_ROM_SIZE, file) == BENCH_ROM_SIZE;
+        if (file) ok &= !fclose(file);
+        if (!ok) fprintf(stderr, "error writing %s\n", filename);
+    }
+    free(rom);
+    return ok;
+}
+
+static void usage(char* prog) {
+    fprintf(stderr,
+            "usage: %s [-f frames] [-o file] [-w name=rom]... [-e dir]\n"
+            "  -f frames    frames to run per workload (default 1800)\n"
+            "  -o file      append results as a json line to file\n"
+            "  -w name=rom  run workload name on rom instead of the built in "
+            "one\n"
+            "  -e dir       write the built in roms to dir and exit\n"
+            "workloads:",
+            prog);
+    for (int i = 0; i < N_WORKLOADS; i++) {
+        fprintf(stderr, " %s", workloads[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv) {
+    unsigned long frames = 1800;
+    char* out_filename = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:o:w:e:")) != -1) {
+        switch (opt) {
+            case 'f':
+                frames = strtoul(optarg, NULL, 0);
+                break;
+            case 'o':
+                out_filename = optarg;
+                break;
+            case 'w': {
+                char* eq = strchr(optarg, '=');
+                int i = N_WORKLOADS;
+                if (eq) {
+                    *eq = '\0';
+                    for (i = 0; i < N_WORKLOADS; i++) {
+                        if (!strcmp(workloads[i].name, optarg)) break;
+                    }
+                }
+                if (i == N_WORKLOADS) {
+                    usage(argv[0]);
+                    return -1;
+                }
+                workloads[i].rom_filename = eq + 1;
+                break;
+            }
+            case 'e':
+                return export_roms(optarg) ? 0 : -1;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+
+    FILE* out = NULL;
+    if (out_filename) {
+        out = fopen(out_filename, "a");
+        if (!out) {
+            fprintf(stderr, "could not open %s\n", out_filename);
+            return -1;
+        }
+        fprintf(out, "{\"time\": %ld, \"frames\": %lu, \"workloads\": [",
+                (long) time(NULL), frames);
+    }
+
+    printf("%-8s %8s %10s %8s", "workload", "fps", "cycles/s", "MHz");
+    for (int i = 0; i < PROF_MAX; i++) printf(" %6s", prof_names[i]);
+    printf("\n");
+
+    int status = 0;
+    int n_results = 0;
+    for (int i = 0; i < N_WORKLOADS; i++) {
+        struct workload* w = &workloads[i];
+        struct bench_result res;
+        if (!run_workload(w, frames, &res)) {
+            fprintf(stderr, "error loading workload %s\n", w->name);
+            status = -1;
+            continue;
+        }
+
+        unsigned long total = 0;
+        for (int j = 0; j < PROF_MAX; j++) total += res.samples[j];
+        if (!total) total = 1;
+
+        double fps = res.frames / res.time;
+        double cps = res.cycles / res.time;
+        printf("%-8s %8.1f %10.0f %8.2f", w->name, fps, cps, cps / 1e6);
+        for (int j = 0; j < PROF_MAX; j++) {
+            printf(" %5.1f%%", 100.0 * res.samples[j] / total);
+        }
+        printf("\n");
+
+        if (out) {
+            fprintf(out,
+                    "%s{\"name\": \"%s\", \"rom\": \"%s\", \"frames\": %lu, "
+                    "\"cycles\": %llu, \"seconds\": %.6f, \"fps\": %.2f, "
+                    "\"cycles_per_sec\": %.0f, \"realtime\": %.3f, "
+                    "\"share\": {",
+                    n_results++ ? ", " : "", w->name,
+                    w->rom_filename ? w->rom_filename : "builtin", res.frames,
+                    (unsigned long long) res.cycles, res.time, fps, cps,
+                    cps / GB_CLOCK_FREQ);
+            for (int j = 0; j < PROF_MAX; j++) {
+                fprintf(out, "%s\"%s\": %.4f", j ? ", " : "", prof_names[j],
+                        (double) res.samples[j] / total);
+            }
+            fprintf(out, "}}");
+        }
+    }
+
+    if (out) {
+        fprintf(out, "]}\n");
+        fclose(out);
+    }
+    return status;
+}
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include "blip.h"
+
+#include <string.h>
+
+// a windowed sinc step, split into phases by where it falls between output
+// samples. the phases past the middle are the earlier ones mirrored. each
+// phase sums to 1 << 15 so steps come out at exactly their height
+static const s16 kernel[BLIP_PHASES / 2 + 1][BLIP_WIDTH] = {
+    {18, -110, 359, -843, 1561, -2371, 3025, 29490,
+     3025, -2371, 1561, -843, 359, -110, 18, 0},
+    {17, -108, 347, -795, 1421, -2025, 2117, 29452,
+     3974, -2714, 1693, -887, 369, -111, 18, 0},
+    {17, -105, 332, -742, 1276, -1679, 1252, 29332,
+     4960, -3051, 1818, -925, 376, -110, 17, 0},
+    {16, -102, 315, -686, 1128, -1335, 434, 29131,
+     5981, -3378, 1932, -956, 380, -109, 17, 0},
+    {16, -98, 297, -627, 977, -997, -336, 28853,
+     7031, -3693, 2036, -982, 381, -106, 16, 0},
+    {15, -93, 277, -566, 824, -665, -1055, 28499,
+     8106, -3992, 2127, -999, 378, -103, 15, 0},
+    {14, -87, 256, -503, 672, -343, -1721, 28067,
+     9203, -4273, 2204, -1009, 372, -97, 13, 0},
+    {13, -82, 234, -439, 522, -34, -2334, 27565,
+     10317, -4531, 2266, -1011, 362, -91, 11, 0},
+    {12, -76, 211, -375, 374, 262, -2891, 26992,
+     11444, -4765, 2311, -1004, 348, -83, 8, 0},
+    {10, -69, 188, -311, 229, 543, -3394, 26350,
+     12577, -4970, 2339, -987, 330, -73, 6, 0},
+    {9, -63, 165, -248, 90, 807, -3840, 25646,
+     13712, -5144, 2348, -962, 308, -62, 2, 0},
+    {8, -56, 142, -186, -44, 1052, -4231, 24877,
+     14845, -5283, 2338, -926, 282, -50, -1, 1},
+    {7, -50, 119, -126, -171, 1277, -4566, 24057,
+     15970, -5386, 2307, -881, 251, -36, -5, 1},
+    {6, -44, 96, -68, -291, 1482, -4846, 23182,
+     17081, -5448, 2255, -825, 217, -21, -10, 2},
+    {5, -37, 74, -12, -403, 1666, -5072, 22257,
+     18174, -5467, 2182, -760, 178, -4, -15, 2},
+    {4, -31, 53, 41, -506, 1828, -5246, 21289,
+     19243, -5441, 2086, -685, 136, 14, -20, 3},
+    {3, -25, 33, 90, -600, 1968, -5368, 20283,
+     20283, -5368, 1968, -600, 90, 33, -25, 3},
+};
+
+// the integrator leaks a little every sample, which filters out dc like the
+// capacitors on the real outputs
+#define BASS_SHIFT 9
+
+void blip_init(struct blip* b, long clock_rate, long sample_rate) {
+    memset(b, 0, sizeof *b);
+    blip_set_rates(b, clock_rate, sample_rate);
+}
+
+// changes the resampling ratio without losing anything buffered. the new
+// ratio applies from the start of the current frame
+void blip_set_rates(struct blip* b, long clock_rate, double sample_rate) {
+    b->factor = sample_rate / clock_rate * 4294967296.0 + 0.5;
+}
+
+void blip_add_delta(struct blip* b, long clock, int delta) {
+    u64 pos = b->offset + clock * b->factor;
+    u64 index = pos >> 32;
+    int phase = (pos >> (32 - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1);
+    // a reader that has fallen far enough behind loses steps
+    if (index >= BLIP_BUF_SIZE) return;
+
+    s32* out = b->buf + index;
+    if (phase <= BLIP_PHASES / 2) {
+        const s16* k = kernel[phase];
+        for (int i = 0; i < BLIP_WIDTH; i++) out[i] += k[i] * delta;
+    } else {
+        const s16* k = kernel[BLIP_PHASES - phase];
+        for (int i = 0; i < BLIP_WIDTH; i++) {
+            out[i] += k[BLIP_WIDTH - 1 - i] * delta;
+        }
+    }
+}
+
+// makes the samples up to the given clock available to read and starts a new
+// frame there
+void blip_end_frame(struct blip* b, long clocks) {
+    b->offset += clocks * b->factor;
+    // drop the oldest samples if nobody is reading them
+    int over = blip_samples_avail(b) - BLIP_BUF_SIZE / 2;
+    if (over > 0) blip_read_samples(b, NULL, over, 0, 0);
+}
+
+int blip_samples_avail(struct blip* b) {
+    return b->offset >> 32;
+}
+
+// reads up to count samples, every stride floats into out scaled by scale,
+// or throws them away if out is null. returns the number read
+int blip_read_samples(struct blip* b, float* out, int count, int stride,
+                      float scale) {
+    int avail = blip_samples_avail(b);
+    if (count > avail) count = avail;
+
+    s32 sum = b->integrator;
+    for (int i = 0; i < count; i++) {
+        sum += b->buf[i];
+        if (out) out[i * stride] = (float) sum / (1 << 15) * scale;
+        sum -= sum >> BASS_SHIFT;
+    }
+    b->integrator = sum;
+
+    // steps from a frame that has not ended yet can be anywhere past avail
+    int remain = BLIP_BUF_SIZE + BLIP_WIDTH - count;
+    memmove(b->buf, b->buf + count, remain * sizeof b->buf[0]);
+    memset(b->buf + remain, 0, count * sizeof b->buf[0]);
+    b->offset -= (u64) count << 32;
+    return count;
+}
\ No newline at end of file
@@ -0,0 +1,33 @@
+#ifndef BLIP_H
+#define BLIP_H
+
+#include "types.h"
+
+#define BLIP_BUF_SIZE 8192
+#define BLIP_WIDTH 16
+#define BLIP_PHASE_BITS 5
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS)
+
+/*
+band-limited step synthesis. amplitude changes are added at the clock they
+happen on as a band-limited step, so output at any sample rate comes out
+without aliasing. clocks are counted from the start of the current frame
+*/
+struct blip {
+    // output samples per clock, 32.32 fixed point
+    u64 factor;
+    // position of the end of the last frame in output samples, 32.32
+    u64 offset;
+    s32 integrator;
+    s32 buf[BLIP_BUF_SIZE + BLIP_WIDTH];
+};
+
+void blip_init(struct blip* b, long clock_rate, long sample_rate);
+void blip_set_rates(struct blip* b, long clock_rate, double sample_rate);
+void blip_add_delta(struct blip* b, long clock, int delta);
+void blip_end_frame(struct blip* b, long clocks);
+int blip_samples_avail(struct blip* b);
+int blip_read_samples(struct blip* b, float* out, int count, int stride,
+                      float scale);
+
+#endif
\ No newline at end of file
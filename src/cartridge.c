@@ -1,24 +1,24 @@
 #include "cartridge.h"
 
-#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/mman.h>
-#include <unistd.h>
 
+#include "ppu.h"
+#include "rom.h"
 #include "types.h"
 
+// the rom file may be gzipped
 struct cartridge* cart_create(char* filename) {
-    FILE* fp = fopen(filename, "rb");
-    if (!fp) return NULL;
-    u8 data[3];
-    fseek(fp, 0x0147, SEEK_SET);
-    if (fread(data, 1, 3, fp) < 3) {
-        fclose(fp);
+    size_t rom_size;
+    u32 rom_crc;
+    u8* rom = rom_acquire(filename, &rom_size, &rom_crc);
+    if (!rom) return NULL;
+    if (rom_size < 0x150) {
+        rom_release(rom);
         return NULL;
     }
-    fseek(fp, 0, SEEK_SET);
+    u8* data = rom + 0x0147;
     enum mbc mbc;
     if (data[0] == 0 || data[0] == 0x08 || data[0] == 0x09) mbc = MBC0;
     else if (0x01 <= data[0] && data[0] <= 0x03) mbc = MBC1;
@@ -29,7 +29,7 @@ struct cartridge* cart_create(char* filename) {
     else if (data[0] == 0x20) mbc = MBC6;
     else if (data[0] == 0x22) mbc = MBC7;
     else {
-        fclose(fp);
+        rom_release(rom);
         return NULL;
     }
     bool battery = false;
@@ -52,9 +52,11 @@ struct cartridge* cart_create(char* filename) {
     }
     bool has_rtc = data[0] == 0x0f || data[0] == 0x10;
     int rom_banks;
-    if (0 <= data[1] && data[1] <= 8) rom_banks = 2 << data[1];
-    else {
-        fclose(fp);
+    if (0 <= data[1] && data[1] <= 8 &&
+        rom_size >= (2 << data[1]) * ROM_BANK_SIZE) {
+        rom_banks = 2 << data[1];
+    } else {
+        rom_release(rom);
         return NULL;
     }
     int ram_banks;
@@ -76,7 +78,7 @@ struct cartridge* cart_create(char* filename) {
             ram_banks = 8;
             break;
         default:
-            fclose(fp);
+            rom_release(rom);
             return NULL;
     }
     struct cartridge* cart = calloc(1, sizeof(*cart));
@@ -86,6 +88,12 @@ struct cartridge* cart_create(char* filename) {
     strcpy(cart->rom_filename, filename);
     int i = filename_len;
     while (i >= 0 && filename[i] != '.') i--;
+    // game.gb.gz saves to game.sav like game.gb does
+    if (i > 0 && !strcmp(filename + i, ".gz")) {
+        int j = i - 1;
+        while (j >= 0 && filename[j] != '.' && filename[j] != '/') j--;
+        if (j > 0 && filename[j] == '.') i = j;
+    }
     cart->sav_filename = malloc(i + 5);
     cart->sst_filename = malloc(i + 5);
     strncpy(cart->sav_filename, filename, i + 1);
@@ -98,15 +106,8 @@ struct cartridge* cart_create(char* filename) {
     cart->has_rtc = has_rtc;
     cart->rom_banks = rom_banks;
     cart->ram_banks = ram_banks;
-    cart->rom = malloc(cart->rom_banks * ROM_BANK_SIZE);
-    if (fread(cart->rom, ROM_BANK_SIZE, cart->rom_banks, fp) <
-        cart->rom_banks) {
-        free(cart->rom);
-        free(cart);
-        fclose(fp);
-        return NULL;
-    }
-    fclose(fp);
+    cart->rom = (u8(*)[ROM_BANK_SIZE]) rom;
+    cart->rom_crc = rom_crc;
 
     cart->sav_size = cart->ram_banks * SRAM_BANK_SIZE +
                      (cart->has_rtc ? sizeof(struct rtc) : 0);
@@ -114,15 +115,17 @@ struct cartridge* cart_create(char* filename) {
     cart->cgb_compat = cart->rom[0][0x0143] & 0x80;
     memcpy(cart->title, &cart->rom[0][0x0134], sizeof cart->title);
 
+    // with nothing to save there is no writer, and battery is left unset
+    if (!cart->sav_size) cart->battery = false;
     if (cart->battery) {
-        cart->sav_fd =
-            open(cart->sav_filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
-        if (ftruncate(cart->sav_fd, cart->sav_size)) {
+        cart->ram = calloc(1, cart->sav_size);
+        if (!cart->ram ||
+            !battery_open(&cart->sav, cart->sav_filename, (u8*) cart->ram,
+                          cart->sav_size)) {
+            cart->battery = false;
             cart_destroy(cart);
             return NULL;
         }
-        cart->ram = mmap(NULL, cart->sav_size, PROT_READ | PROT_WRITE,
-                         MAP_SHARED, cart->sav_fd, 0);
         if (cart->has_rtc) cart->rtc = (struct rtc*) cart->ram[cart->ram_banks];
     } else if (cart->ram_banks) {
         cart->ram = calloc(cart->ram_banks, SRAM_BANK_SIZE);
@@ -130,45 +133,109 @@ struct cartridge* cart_create(char* filename) {
     return cart;
 }
 
+// moves the clock on by secs seconds
+static void rtc_advance(struct rtc* rtc, u64 secs) {
+    int days = ((rtc->set.dayh & 1) << 8) + rtc->set.day;
+    u64 t = secs +
+            ((days * 24 + rtc->set.hr) * 60 + rtc->set.min) * 60 + rtc->set.sec;
+    rtc->set.sec = t % 60;
+    t /= 60;
+    rtc->set.min = t % 60;
+    t /= 60;
+    rtc->set.hr = t % 24;
+    t /= 24;
+    rtc->set.day = t & 0xff;
+    bool old_carry = rtc->set.dayh & RTC_CARRY;
+    rtc->set.dayh = (t & 0x100) >> 8;
+    if (t > 511 || old_carry) rtc->set.dayh |= RTC_CARRY;
+}
+
+// brings the clock registers up to the emulated cycle count, or to the host
+// clock in RTC_HOST mode
+static void rtc_update(struct cartridge* cart, u64 cycles) {
+    struct rtc* rtc = cart->rtc;
+    if (cart->rtc_mode == RTC_HOST) {
+        if (rtc->set.dayh & RTC_HALT) return;
+        time_t now = time(NULL);
+        if (now > rtc->set_time) rtc_advance(rtc, now - rtc->set_time);
+        rtc->set_time = now;
+        return;
+    }
+    // whole seconds only, the rest is counted towards the next one. the
+    // clock counts at the same rate in double speed mode
+    u64 secs = (cycles - cart->st.mbc3.rtc_cycles) / GB_CLOCK_FREQ;
+    cart->st.mbc3.rtc_cycles += secs * GB_CLOCK_FREQ;
+    if (!(rtc->set.dayh & RTC_HALT)) rtc_advance(rtc, secs);
+}
+
+// the clock starts counting from now when it is let go of
+static void rtc_start(struct cartridge* cart, u64 cycles) {
+    if (cart->rtc_mode == RTC_HOST) cart->rtc->set_time = time(NULL);
+    else cart->st.mbc3.rtc_cycles = cycles;
+}
+
+// in RTC_SYNC mode the clock first catches up with the time the save file
+// was closed for. call before the first frame
+void cart_set_rtc_mode(struct cartridge* cart, enum rtc_mode mode) {
+    cart->rtc_mode = mode;
+    if (!cart->has_rtc || !cart->battery || mode != RTC_SYNC) return;
+    struct rtc* rtc = cart->rtc;
+    time_t now = time(NULL);
+    // a new save has no time to catch up from
+    if (rtc->set_time && now > rtc->set_time &&
+        !(rtc->set.dayh & RTC_HALT)) {
+        rtc_advance(rtc, now - rtc->set_time);
+    }
+    rtc->set_time = now;
+    cart->sav_dirty |= 1 << cart->ram_banks;
+}
+
+// the clock is saved along with the host time it was current at
+static void rtc_stamp(struct cartridge* cart) {
+    rtc_update(cart, cart->frame_cycles);
+    cart->rtc->set_time = time(NULL);
+    cart->sav_dirty |= 1 << cart->ram_banks;
+}
+
 void cart_destroy(struct cartridge* cart) {
     if (!cart) return;
-    free(cart->rom);
+    rom_release((u8*) cart->rom);
     if (cart->battery) {
-        munmap(cart->ram, cart->sav_size);
-        close(cart->sav_fd);
-    } else {
-        free(cart->ram);
+        if (cart->has_rtc && cart->rtc_mode == RTC_SYNC) rtc_stamp(cart);
+        battery_stage(&cart->sav, (u8*) cart->ram, cart->sav_dirty);
+        battery_close(&cart->sav);
     }
+    free(cart->ram);
     free(cart->rom_filename);
     free(cart->sav_filename);
     free(cart->sst_filename);
     free(cart);
 }
 
-u8 cart_read(struct cartridge* cart, u16 addr, enum cart_region region) {
-    if (!cart) return 0xff;
+u8* cart_bank(struct cartridge* cart, enum cart_region region) {
+    if (!cart) return NULL;
     switch (cart->mbc) {
         case MBC0:
             switch (region) {
                 case CART_ROM0:
-                    return cart->rom[0][addr];
+                    return cart->rom[0];
                 case CART_ROM1:
-                    return cart->rom[1][addr];
+                    return cart->rom[1];
                 case CART_RAM:
-                    if (cart->ram_banks) return cart->ram[0][addr];
-                    else return 0xff;
+                    if (cart->ram_banks) return cart->ram[0];
+                    else return NULL;
             }
         case MBC1:
             switch (region) {
                 case CART_ROM0:
                     if (cart->st.mbc1.mode == 0) {
-                        return cart->rom[0][addr];
+                        return cart->rom[0];
                     } else {
                         if (cart->rom_banks > 32) {
                             return cart->rom[(cart->st.mbc1.cur_bank_2 << 5) &
-                                             (cart->rom_banks - 1)][addr];
+                                             (cart->rom_banks - 1)];
                         } else {
-                            return cart->rom[0][addr];
+                            return cart->rom[0];
                         }
                     }
                 case CART_ROM1:
@@ -178,92 +245,101 @@ u8 cart_read(struct cartridge* cart, u16 addr, enum cart_region region) {
                                       ((cart->rom_banks > 32)
                                            ? (cart->st.mbc1.cur_bank_2 << 5)
                                            : 0)) &
-                                     (cart->rom_banks - 1)][addr];
+                                     (cart->rom_banks - 1)];
                 case CART_RAM:
                     if (cart->ram_banks && cart->st.mbc1.ram_enable) {
                         if (cart->st.mbc1.mode == 0 || cart->rom_banks > 32) {
-                            return cart->ram[0][addr];
+                            return cart->ram[0];
                         } else {
                             return cart->ram[cart->st.mbc1.cur_bank_2 &
-                                             (cart->ram_banks - 1)][addr];
+                                             (cart->ram_banks - 1)];
                         }
-                    } else return 0xff;
+                    } else return NULL;
             }
         case MBC3:
             switch (region) {
                 case CART_ROM0:
-                    return cart->rom[0][addr];
+                    return cart->rom[0];
                 case CART_ROM1:
                     return cart->rom[(cart->st.mbc3.cur_rom_bank
                                           ? cart->st.mbc3.cur_rom_bank
                                           : 1) &
-                                     (cart->rom_banks - 1)][addr];
+                                     (cart->rom_banks - 1)];
                 case CART_RAM:
-                    if (cart->st.mbc3.ram_enable) {
-                        if (!cart->has_rtc ||
-                            (cart->st.mbc3.cur_ram_bank & 0b1000) == 0) {
-                            if (cart->ram_banks) {
-                                return cart->ram[cart->st.mbc3.cur_ram_bank &
-                                                 (cart->ram_banks - 1)][addr];
-                            } else return 0xff;
-                        } else {
-                            switch (cart->st.mbc3.cur_ram_bank & 0b0111) {
-                                case 0:
-                                    return cart->rtc->latch.sec;
-                                case 1:
-                                    return cart->rtc->latch.min;
-                                case 2:
-                                    return cart->rtc->latch.hr;
-                                case 3:
-                                    return cart->rtc->latch.day;
-                                case 4:
-                                    return cart->rtc->latch.dayh;
-                                default:
-                                    return 0xff;
-                            }
-                        }
-                    } else return 0xff;
+                    if (cart->ram_banks && cart->st.mbc3.ram_enable &&
+                        (!cart->has_rtc ||
+                         (cart->st.mbc3.cur_ram_bank & 0b1000) == 0)) {
+                        return cart->ram[cart->st.mbc3.cur_ram_bank &
+                                         (cart->ram_banks - 1)];
+                    } else return NULL;
             }
         case MBC5:
             switch (region) {
                 case CART_ROM0:
-                    return cart->rom[0][addr];
+                    return cart->rom[0];
                 case CART_ROM1:
                     return cart->rom[(cart->st.mbc5.cur_rom_bank) &
-                                     (cart->rom_banks - 1)][addr];
+                                     (cart->rom_banks - 1)];
                 case CART_RAM:
                     if (cart->ram_banks && cart->st.mbc5.ram_enable) {
                         return cart->ram[cart->st.mbc5.cur_ram_bank &
-                                         (cart->ram_banks - 1)][addr];
-                    } else return 0xff;
+                                         (cart->ram_banks - 1)];
+                    } else return NULL;
             }
         default:
-            return 0xff;
+            return NULL;
     }
 }
 
-void rtc_update(struct rtc* rtc) {
-    if (rtc->set.dayh & RTC_HALT) return;
-    time_t cur_time = time(NULL);
-    time_t t = cur_time - rtc->set_time;
-    rtc->set_time = cur_time;
-    int days = ((rtc->set.dayh & 1) << 8) + rtc->set.day;
-    t += ((days * 24 + rtc->set.hr) * 60 + rtc->set.min) * 60 + rtc->set.sec;
-    rtc->set.sec = t % 60;
-    t /= 60;
-    rtc->set.min = t % 60;
-    t /= 60;
-    rtc->set.hr = t % 24;
-    t /= 24;
-    rtc->set.day = t & 0xff;
-    bool old_carry = rtc->set.dayh & RTC_CARRY;
-    rtc->set.dayh = (t & 0x100) >> 8;
-    if (t > 511 || old_carry) rtc->set.dayh &= RTC_CARRY;
+u8 cart_read(struct cartridge* cart, u16 addr, enum cart_region region) {
+    u8* bank = cart_bank(cart, region);
+    if (bank) return bank[addr];
+    // everything else that is not open bus is the mbc3 clock
+    if (cart && cart->mbc == MBC3 && region == CART_RAM &&
+        cart->st.mbc3.ram_enable && cart->has_rtc &&
+        (cart->st.mbc3.cur_ram_bank & 0b1000)) {
+        switch (cart->st.mbc3.cur_ram_bank & 0b0111) {
+            case 0:
+                return cart->rtc->latch.sec;
+            case 1:
+                return cart->rtc->latch.min;
+            case 2:
+                return cart->rtc->latch.hr;
+            case 3:
+                return cart->rtc->latch.day;
+            case 4:
+                return cart->rtc->latch.dayh;
+        }
+    }
+    return 0xff;
+}
+
+// marks a ram bank the cpu may write to without going through cart_write
+void cart_ram_mapped(struct cartridge* cart, u8* bank) {
+    if (!cart->battery || !bank) return;
+    cart->sav_dirty |= 1 << (bank - cart->ram[0]) / SRAM_BANK_SIZE;
+}
+
+// hands the battery ram that changed in the frame to the writer. the bank
+// still mapped for writes, if any, may change again in the next frame
+void cart_end_frame(struct cartridge* cart, u8* ram_mapped, u64 cycles) {
+    if (!cart) return;
+    cart->frame_cycles = cycles;
+    if (!cart->battery) return;
+    battery_stage(&cart->sav, (u8*) cart->ram, cart->sav_dirty);
+    cart->sav_dirty = 0;
+    cart_ram_mapped(cart, ram_mapped);
 }
 
 void cart_write(struct cartridge* cart, u16 addr, enum cart_region region,
-                u8 data) {
+                u8 data, u64 cycles) {
     if (!cart) return;
+    if (region == CART_RAM && cart->battery) {
+        // either a bank or the clock, which follows the banks
+        u8* bank = cart_bank(cart, CART_RAM);
+        if (bank) cart_ram_mapped(cart, bank);
+        else cart->sav_dirty |= 1 << cart->ram_banks;
+    }
     switch (cart->mbc) {
         case MBC0:
             if (region == CART_RAM && cart->ram_banks)
@@ -316,9 +392,12 @@ void cart_write(struct cartridge* cart, u16 addr, enum cart_region region,
                         if (data == 0) cart->st.mbc3.latching = true;
                         if (data == 1 && cart->st.mbc3.latching) {
                             cart->st.mbc3.latching = false;
-                            rtc_update(cart->rtc);
+                            rtc_update(cart, cycles);
                             memcpy(&cart->rtc->latch, &cart->rtc->set,
                                    sizeof(struct rtc_time));
+                            if (cart->battery) {
+                                cart->sav_dirty |= 1 << cart->ram_banks;
+                            }
                         }
                     }
                     break;
@@ -346,15 +425,15 @@ void cart_write(struct cartridge* cart, u16 addr, enum cart_region region,
                                         cart->rtc->set.day = data;
                                         break;
                                     case 4:
-                                        cart->rtc->set.dayh = data & 0x11000001;
+                                        cart->rtc->set.dayh = data & 0b11000001;
                                         if (!(data & RTC_HALT))
-                                            cart->rtc->set_time = time(NULL);
+                                            rtc_start(cart, cycles);
                                         break;
                                 }
                             } else if (cart->st.mbc3.cur_ram_bank == 0xc &&
                                        data & RTC_HALT) {
-                                rtc_update(cart->rtc);
-                                cart->rtc->set.dayh &= RTC_HALT;
+                                rtc_update(cart, cycles);
+                                cart->rtc->set.dayh |= RTC_HALT;
                             }
                         }
                     }
@@ -3,6 +3,7 @@
 
 #include <time.h>
 
+#include "battery.h"
 #include "types.h"
 
 #define ROM_BANK_SIZE 0x4000  // 16k
@@ -25,24 +26,46 @@ struct rtc_time {
 struct rtc {
     struct rtc_time set;
     struct rtc_time latch;
+    // host time set was current at
     time_t set_time;
 };
 
+enum rtc_mode {
+    // runs on emulated cycles, so the same inputs always read the same time
+    RTC_CYCLES,
+    // as RTC_CYCLES, but catches up with the host clock when the save file
+    // is loaded and stamps it when the save is closed
+    RTC_SYNC,
+    // reads the host clock on every latch
+    RTC_HOST
+};
+
 struct cartridge {
     u8 title[0x10];
+    // of the whole rom, to tell which game a save state belongs to
+    u32 rom_crc;
     enum mbc mbc;
 
     int rom_banks;
     int ram_banks;
 
+    // mapped read only, and shared by every cartridge of the same rom
     u8 (*rom)[ROM_BANK_SIZE];
     u8 (*ram)[SRAM_BANK_SIZE];
 
     bool battery;
-    int sav_fd;
     bool has_rtc;
     struct rtc* rtc;
+    enum rtc_mode rtc_mode;
+    // at the end of the last frame, to bring the clock up to date on close
+    u64 frame_cycles;
+    // the rtc is stored after the ram banks, in the ram allocation and in
+    // the save file
     size_t sav_size;
+    // save file write back, and the 8k chunks of ram and rtc that may have
+    // changed since the last cart_end_frame
+    struct battery sav;
+    u32 sav_dirty;
 
     char* rom_filename;
     char* sav_filename;
@@ -62,6 +85,8 @@ struct cartridge {
             u8 cur_rom_bank;
             u8 cur_ram_bank;
             bool latching;
+            // cycle the clock last ticked at
+            u64 rtc_cycles;
         } mbc3;
         struct {
             u8 ram_enable;
@@ -80,8 +105,14 @@ struct cartridge {
 struct cartridge* cart_create(char* filename);
 void cart_destroy(struct cartridge* cart);
 
+// host memory currently banked into a region, or null if accesses to the
+// region are not plain reads and writes of rom or ram
+u8* cart_bank(struct cartridge* cart, enum cart_region region);
 u8 cart_read(struct cartridge* cart, u16 addr, enum cart_region region);
 void cart_write(struct cartridge* cart, u16 addr, enum cart_region region,
-                u8 data);
+                u8 data, u64 cycles);
+void cart_ram_mapped(struct cartridge* cart, u8* bank);
+void cart_end_frame(struct cartridge* cart, u8* ram_mapped, u64 cycles);
+void cart_set_rtc_mode(struct cartridge* cart, enum rtc_mode mode);
 
 #endif
\ No newline at end of file
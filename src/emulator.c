@@ -1,14 +1,25 @@
 #include "emulator.h"
 
 #include <SDL2/SDL.h>
-#include <zlib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "gb.h"
 #include "sm83.h"
+#include "state.h"
 
 struct emulator gbemu;
 
-bool emulator_init() {
+// runs on sdl's audio thread
+static void audio_callback(void* userdata, Uint8* stream, int len) {
+    ring_read(userdata, (float*) stream, len / (2 * sizeof(float)));
+}
+
+bool emulator_init(int audio_latency_ms, enum pace_mode pace_mode,
+                   int rewind_interval, int rewind_mb) {
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMECONTROLLER) <
         0) {
         return false;
@@ -26,56 +37,239 @@ bool emulator_init() {
         gbemu.main_renderer, SDL_PIXELFORMAT_ARGB8888,
         SDL_TEXTUREACCESS_STREAMING, GB_SCREEN_W, GB_SCREEN_H);
 
+    if (!ring_init(&gbemu.audio_ring, AUDIO_RING_FRAMES)) return false;
+    gbemu.audio_latency_ms = audio_latency_ms;
+    gbemu.pace_mode = pace_mode;
+
     SDL_AudioSpec audio_spec = {.freq = SAMPLE_FREQ,
                                 .format = AUDIO_F32,
                                 .channels = 2,
-                                .samples = SAMPLE_BUF_LEN / 2};
-    gbemu.gb_audio = SDL_OpenAudioDevice(NULL, 0, &audio_spec, NULL, 0);
+                                .samples = AUDIO_DEVICE_FRAMES,
+                                .callback = audio_callback,
+                                .userdata = &gbemu.audio_ring};
+    SDL_AudioSpec audio_have;
+    gbemu.gb_audio =
+        SDL_OpenAudioDevice(NULL, 0, &audio_spec, &audio_have,
+                            SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
     if (gbemu.gb_audio == 0) {
         return false;
     }
-    SDL_PauseAudioDevice(gbemu.gb_audio, 0);
+    gbemu.audio_freq = audio_have.freq;
 
     if (SDL_NumJoysticks() > 0) {
         gbemu.controller = SDL_GameControllerOpen(0);
     }
 
     gbemu.gb = malloc(sizeof *gbemu.gb);
+    init_gb_config(&gbemu.gb->cfg);
+    // the apu resamples to whatever rate the device runs at
+    gbemu.gb->cfg.sample_rate = gbemu.audio_freq;
 
     gbemu.paused = true;
 
-    gbemu.dmg_colors[0] = 0x00ffffff;
-    gbemu.dmg_colors[1] = 0x0000e000;
-    gbemu.dmg_colors[2] = 0x0009000;
-    gbemu.dmg_colors[3] = 0x00000000;
-
-    gbemu.speed = 1;
     gbemu.speedup_speed = 5;
 
+    gbemu.rewind_interval = rewind_interval;
+    gbemu.rewind_mb = rewind_mb;
+
+    gbemu.back = 0;
+    gbemu.front = 1;
+    atomic_init(&gbemu.frame_ready, 2);
+    gbemu.lock = SDL_CreateMutex();
+    if (!gbemu.lock) return false;
+    atomic_init(&gbemu.quit, false);
+
+    gbemu.sst_lock = SDL_CreateMutex();
+    gbemu.sst_cond = SDL_CreateCond();
+    if (!gbemu.sst_lock || !gbemu.sst_cond) return false;
+    atomic_init(&gbemu.sst_result, SST_IDLE);
+
     return true;
 }
 
 void emulator_quit() {
+    if (gbemu.emu_thread) {
+        atomic_store(&gbemu.quit, true);
+        SDL_WaitThread(gbemu.emu_thread, NULL);
+    }
+    SDL_DestroyMutex(gbemu.lock);
+
+    // a save still being written is finished first
+    if (gbemu.sst_thread) {
+        SDL_LockMutex(gbemu.sst_lock);
+        gbemu.sst_quit = true;
+        SDL_CondSignal(gbemu.sst_cond);
+        SDL_UnlockMutex(gbemu.sst_lock);
+        SDL_WaitThread(gbemu.sst_thread, NULL);
+    }
+    SDL_DestroyCond(gbemu.sst_cond);
+    SDL_DestroyMutex(gbemu.sst_lock);
+    free(gbemu.sst_state);
+    free(gbemu.sst_out);
+    free(gbemu.sst_tmp_filename);
+
+    emu_stop_movie();
+    rewind_free(&gbemu.rewind);
     free(gbemu.gb);
     cart_destroy(gbemu.cart);
 
     SDL_GameControllerClose(gbemu.controller);
 
     SDL_CloseAudioDevice(gbemu.gb_audio);
+    unsigned long underruns = gbemu.audio_ring.underruns;
+    unsigned long overruns = gbemu.audio_ring.overruns;
+    if (underruns || overruns) {
+        printf("audio underruns: %lu frames, overruns: %lu frames\n",
+               underruns, overruns);
+    }
+    ring_free(&gbemu.audio_ring);
 
     SDL_DestroyRenderer(gbemu.main_renderer);
     SDL_DestroyWindow(gbemu.main_window);
     SDL_Quit();
 }
 
+static void gb_handle_event(struct gb* gb, SDL_Event* e) {
+    if (e->type == SDL_KEYDOWN) {
+        switch (e->key.keysym.scancode) {
+            case SDL_SCANCODE_UP:
+                gb->jp_dir |= JP_U_SL;
+                break;
+            case SDL_SCANCODE_DOWN:
+                gb->jp_dir |= JP_D_ST;
+                break;
+            case SDL_SCANCODE_LEFT:
+                gb->jp_dir |= JP_L_B;
+                break;
+            case SDL_SCANCODE_RIGHT:
+                gb->jp_dir |= JP_R_A;
+                break;
+            case SDL_SCANCODE_Z:
+                gb->jp_action |= JP_R_A;
+                break;
+            case SDL_SCANCODE_X:
+                gb->jp_action |= JP_L_B;
+                break;
+            case SDL_SCANCODE_RSHIFT:
+                gb->jp_action |= JP_U_SL;
+                break;
+            case SDL_SCANCODE_RETURN:
+                gb->jp_action |= JP_D_ST;
+                break;
+            default:
+                break;
+        }
+    }
+    if (e->type == SDL_KEYUP) {
+        switch (e->key.keysym.scancode) {
+            case SDL_SCANCODE_UP:
+                gb->jp_dir &= ~JP_U_SL;
+                break;
+            case SDL_SCANCODE_DOWN:
+                gb->jp_dir &= ~JP_D_ST;
+                break;
+            case SDL_SCANCODE_LEFT:
+                gb->jp_dir &= ~JP_L_B;
+                break;
+            case SDL_SCANCODE_RIGHT:
+                gb->jp_dir &= ~JP_R_A;
+                break;
+            case SDL_SCANCODE_Z:
+                gb->jp_action &= ~JP_R_A;
+                break;
+            case SDL_SCANCODE_X:
+                gb->jp_action &= ~JP_L_B;
+                break;
+            case SDL_SCANCODE_RSHIFT:
+                gb->jp_action &= ~JP_U_SL;
+                break;
+            case SDL_SCANCODE_RETURN:
+                gb->jp_action &= ~JP_D_ST;
+                break;
+            default:
+                break;
+        }
+    }
+    if (e->type == SDL_CONTROLLERBUTTONDOWN) {
+        switch (e->cbutton.button) {
+            case SDL_CONTROLLER_BUTTON_DPAD_UP:
+                gb->jp_dir |= JP_U_SL;
+                break;
+            case SDL_CONTROLLER_BUTTON_DPAD_DOWN:
+                gb->jp_dir |= JP_D_ST;
+                break;
+            case SDL_CONTROLLER_BUTTON_DPAD_LEFT:
+                gb->jp_dir |= JP_L_B;
+                break;
+            case SDL_CONTROLLER_BUTTON_DPAD_RIGHT:
+                gb->jp_dir |= JP_R_A;
+                break;
+            case SDL_CONTROLLER_BUTTON_A:
+                gb->jp_action |= JP_R_A;
+                break;
+            case SDL_CONTROLLER_BUTTON_X:
+                gb->jp_action |= JP_L_B;
+                break;
+            case SDL_CONTROLLER_BUTTON_BACK:
+                gb->jp_action |= JP_U_SL;
+                break;
+            case SDL_CONTROLLER_BUTTON_START:
+                gb->jp_action |= JP_D_ST;
+                break;
+            default:
+                break;
+        }
+    }
+    if (e->type == SDL_CONTROLLERBUTTONUP) {
+        switch (e->cbutton.button) {
+            case SDL_CONTROLLER_BUTTON_DPAD_UP:
+                gb->jp_dir &= ~JP_U_SL;
+                break;
+            case SDL_CONTROLLER_BUTTON_DPAD_DOWN:
+                gb->jp_dir &= ~JP_D_ST;
+                break;
+            case SDL_CONTROLLER_BUTTON_DPAD_LEFT:
+                gb->jp_dir &= ~JP_L_B;
+                break;
+            case SDL_CONTROLLER_BUTTON_DPAD_RIGHT:
+                gb->jp_dir &= ~JP_R_A;
+                break;
+            case SDL_CONTROLLER_BUTTON_A:
+                gb->jp_action &= ~JP_R_A;
+                break;
+            case SDL_CONTROLLER_BUTTON_X:
+                gb->jp_action &= ~JP_L_B;
+                break;
+            case SDL_CONTROLLER_BUTTON_BACK:
+                gb->jp_action &= ~JP_U_SL;
+                break;
+            case SDL_CONTROLLER_BUTTON_START:
+                gb->jp_action &= ~JP_D_ST;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+
 void emu_handle_event(SDL_Event e) {
+    SDL_LockMutex(gbemu.lock);
     gb_handle_event(gbemu.gb, &e);
+    gb_update_input(gbemu.gb);
+
+    if ((e.type == SDL_KEYDOWN || e.type == SDL_KEYUP) &&
+        e.key.keysym.sym == SDLK_BACKSPACE) {
+        gbemu.rewinding = e.type == SDL_KEYDOWN;
+        if (gbemu.rewinding) emu_stop_movie();
+    }
 
     if (e.type == SDL_KEYDOWN) {
         switch (e.key.keysym.sym) {
             case SDLK_t:
-                gbemu.force_dmg = !gbemu.force_dmg;
+                gbemu.gb->cfg.force_dmg = !gbemu.gb->cfg.force_dmg;
             case SDLK_r:
+                emu_stop_movie();
                 emu_reset();
                 break;
             case SDLK_p:
@@ -83,10 +277,12 @@ void emu_handle_event(SDL_Event e) {
                 break;
             case SDLK_TAB:
                 gbemu.speedup = !gbemu.speedup;
+                // the apu has to catch up at the old speed
+                apu_sync(&gbemu.gb->apu, gbemu.gb->sched.now);
                 if (gbemu.speedup) {
-                    gbemu.speed = gbemu.speedup_speed;
+                    gbemu.gb->cfg.speed = gbemu.speedup_speed;
                 } else {
-                    gbemu.speed = 1;
+                    gbemu.gb->cfg.speed = 1;
                 }
                 break;
             case SDLK_m:
@@ -96,57 +292,261 @@ void emu_handle_event(SDL_Event e) {
                 save_state();
                 break;
             case SDLK_0:
-                load_state();
+                if (load_state()) emu_stop_movie();
                 break;
             default:
                 break;
         }
     }
+    SDL_UnlockMutex(gbemu.lock);
+}
+
+// hands the frame the ppu just finished to the ui thread and gives the ppu
+// the oldest unshown one back to draw into
+static void publish_frame() {
+    gbemu.back =
+        atomic_exchange(&gbemu.frame_ready, gbemu.back | FRAME_FRESH) & 3;
+    gbemu.gb->ppu.screen = gbemu.frames[gbemu.back];
+}
+
+// ui thread. takes the newest finished frame if there is one since last time
+bool emu_take_frame() {
+    if (!(atomic_load(&gbemu.frame_ready) & FRAME_FRESH)) return false;
+    gbemu.front = atomic_exchange(&gbemu.frame_ready, gbemu.front) & 3;
+    return true;
 }
 
 void update_texture() {
-    Uint32* pixels;
-    int pitch;
-    SDL_LockTexture(gbemu.gb_screen, NULL, (void**) &pixels, &pitch);
-    memcpy(pixels, gbemu.gb->ppu.screen, sizeof gbemu.gb->ppu.screen);
-    SDL_UnlockTexture(gbemu.gb_screen);
+    SDL_UpdateTexture(gbemu.gb_screen, NULL, gbemu.frames[gbemu.front],
+                      sizeof gbemu.frames[0][0]);
 }
 
-void emu_run_frame(bool video, bool audio) {
-    if (!(gbemu.gb->io[LCDC] & LCDC_ENABLE)) {
-        for (int i = 0; i < 10000; i++) {
-            cpu_clock(&gbemu.gb->cpu);
-            if (gbemu.gb->apu.samples_full) {
-                if (audio)
-                    SDL_QueueAudio(
-                        gbemu.gb_audio,
-                        gbemu.gb->apu
-                            .sample_buf[(gbemu.gb->apu.buf_ind - 1) % 2],
-                        sizeof gbemu.gb->apu.sample_buf[0]);
-                gbemu.gb->apu.samples_full = false;
-            }
-            if (gbemu.gb->io[LCDC] & LCDC_ENABLE) break;
+// frames the audio ring should hold to meet the latency target
+u32 emu_audio_target() {
+    return (long) gbemu.audio_freq * gbemu.audio_latency_ms / 1000;
+}
+
+// a paused device does not drain the ring or count underruns. on resume the
+// ring is topped up with silence to the target so playback does not start out
+// starved
+void emu_pause_audio(bool pause) {
+    if (!pause) {
+        u32 target = emu_audio_target();
+        float silence[2 * SAMPLE_BUF_LEN] = {0};
+        while (ring_fill(&gbemu.audio_ring) < target) {
+            u32 n = target - ring_fill(&gbemu.audio_ring);
+            if (n > SAMPLE_BUF_LEN) n = SAMPLE_BUF_LEN;
+            ring_write(&gbemu.audio_ring, silence, n);
         }
+        gbemu.audio_fill_avg = target;
+    }
+    SDL_PauseAudioDevice(gbemu.gb_audio, pause);
+}
+
+static double clamp_rate(double delta) {
+    if (delta > AUDIO_MAX_RATE_DELTA) return AUDIO_MAX_RATE_DELTA;
+    if (delta < -AUDIO_MAX_RATE_DELTA) return -AUDIO_MAX_RATE_DELTA;
+    return delta;
+}
+
+/*
+finishes the frame's audio and hands it to the audio callback. muted frames
+are not mixed and come out silent, but still go in so the ring keeps its
+level. unthrottled, the audio is thrown away. paced by video, the host and
+device clocks never quite agree, so the resampling ratio is nudged by how far
+the averaged fill level is from the target, plus an accumulated term that
+learns the steady mismatch between the clocks
+*/
+static void queue_audio() {
+    gb_end_frame(gbemu.gb);
+    float buf[2 * SAMPLE_BUF_LEN];
+    int n;
+    while ((n = apu_read_samples(&gbemu.gb->apu, buf, SAMPLE_BUF_LEN))) {
+        if (gbemu.pace_mode == PACE_NONE) continue;
+        ring_write(&gbemu.audio_ring, buf, n);
+    }
+    if (gbemu.pace_mode != PACE_VIDEO) {
+        apu_set_rate_ratio(&gbemu.gb->apu, 1);
         return;
     }
 
-    while (!gbemu.gb->ppu.frame_complete) {
-        cpu_clock(&gbemu.gb->cpu);
-        if (gbemu.gb->apu.samples_full) {
-            if (audio)
-                SDL_QueueAudio(
-                    gbemu.gb_audio,
-                    gbemu.gb->apu.sample_buf[(gbemu.gb->apu.buf_ind - 1) % 2],
-                    sizeof gbemu.gb->apu.sample_buf[0]);
-            gbemu.gb->apu.samples_full = false;
+    double target = emu_audio_target();
+    gbemu.audio_fill_avg +=
+        (ring_fill(&gbemu.audio_ring) - gbemu.audio_fill_avg) / 32;
+    double err = (target - gbemu.audio_fill_avg) / target;
+    if (err > 1) err = 1;
+    if (err < -1) err = -1;
+    gbemu.audio_rate_adj = clamp_rate(gbemu.audio_rate_adj + err * 0.00001);
+    double delta =
+        clamp_rate(err * AUDIO_MAX_RATE_DELTA + gbemu.audio_rate_adj);
+    apu_set_rate_ratio(&gbemu.gb->apu, 1 + delta);
+}
+
+// waits until it is time for the next frame, after frames that together ran
+// for the given number of emulated cycles
+void emu_pace(u64 cycles) {
+    switch (gbemu.pace_mode) {
+        case PACE_VIDEO:
+            pace_frame(&gbemu.pacer, cycles);
+            break;
+        case PACE_AUDIO: {
+            // the device drains the ring at its own rate, a device buffer at a
+            // time, so this only needs to poll
+            u32 target = emu_audio_target();
+            u32 fill;
+            while ((fill = ring_fill(&gbemu.audio_ring)) > target) {
+                u64 ns = (u64) (fill - target) * 1000000000 / gbemu.audio_freq;
+                pace_sleep(ns > 500000 ? ns : 500000);
+            }
+            break;
         }
-        if (!(gbemu.gb->io[LCDC] & LCDC_ENABLE)) break;
+        case PACE_NONE:
+            break;
+    }
+}
+
+// a movie being played sets the speed, which goes back to what the fast
+// forward key says once it is over
+static void close_movie(const char* how) {
+    unsigned long frames = gbemu.movie.frame;
+    bool playing = gbemu.movie.mode == MOVIE_PLAYING;
+    if (!movie_close(&gbemu.movie)) {
+        SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "gbemu",
+                                 "Error writing movie!", gbemu.main_window);
+    } else {
+        printf("movie %s after %lu frames\n", how, frames);
+    }
+    if (playing) {
+        apu_sync(&gbemu.gb->apu, gbemu.gb->sched.now);
+        gbemu.gb->cfg.speed = gbemu.speedup ? gbemu.speedup_speed : 1;
+    }
+}
+
+static void end_movie_frame() {
+    switch (movie_end_frame(&gbemu.movie)) {
+        case MOVIE_OK:
+            break;
+        case MOVIE_END:
+            close_movie("finished");
+            break;
+        case MOVIE_DESYNC:
+            close_movie("out of sync");
+            break;
     }
-    gbemu.gb->ppu.frame_complete = false;
-    if (video) update_texture();
+}
+
+// frames are run by gb_run_frame, as headless, so movies play back the same
+// here and there
+void emu_run_frame(bool video, bool audio) {
+    struct gb* gb = gbemu.gb;
+    gb_set_render_skip(gb, (video ? 0 : SKIP_VIDEO) | (audio ? 0 : SKIP_AUDIO));
+    movie_start_frame(&gbemu.movie);
+    bool complete = gb_run_frame(gb);
+    queue_audio();
+    end_movie_frame();
+    if (!complete) return;
+    if (video) publish_frame();
     gbemu.frame++;
 }
 
+// one step of the emulation thread: the frames due now, then the wait until
+// the next ones
+static void emu_run_frames() {
+    static bool audio_paused = true;
+
+    SDL_LockMutex(gbemu.lock);
+    bool paused = gbemu.paused || gbemu.gb->cpu.ill;
+    // unthrottled there is no audio to play
+    bool pause_audio = paused || gbemu.pace_mode == PACE_NONE;
+    if (audio_paused != pause_audio) {
+        audio_paused = pause_audio;
+        emu_pause_audio(audio_paused);
+        pace_reset(&gbemu.pacer);
+    }
+
+    u64 cycles = 0;
+    if (!paused && gbemu.rewinding) {
+        // back a snapshot, then forward a silent frame to have something to
+        // show. going further back than the oldest snapshot just waits
+        if (rewind_step(&gbemu.rewind)) emu_run_frame(true, false);
+        cycles = CYCLES_PER_FRAME;
+    } else if (!paused) {
+        u64 start = gbemu.gb->cycles;
+        for (int i = 0; i < gbemu.gb->cfg.speed - 1; i++) {
+            if (gbemu.rewind_mb) rewind_frame(&gbemu.rewind);
+            emu_run_frame(false, !gbemu.muted);
+        }
+        if (gbemu.rewind_mb) rewind_frame(&gbemu.rewind);
+        emu_run_frame(true, !gbemu.muted);
+        // fast forward runs speed frames in the time of one
+        cycles = (gbemu.gb->cycles - start) / gbemu.gb->cfg.speed;
+    }
+    SDL_UnlockMutex(gbemu.lock);
+
+    if (!paused) {
+        emu_pace(cycles);
+    } else {
+        SDL_Delay(10);
+    }
+}
+
+static int emu_thread_main(void* data) {
+    while (!atomic_load(&gbemu.quit)) emu_run_frames();
+    return 0;
+}
+
+// compresses the state and swaps it in for the old file with a rename, so a
+// crash mid write leaves the last good save in place. the temp file is one of
+// its own, so other sessions of the same rom never write into it
+static bool write_state(size_t size) {
+    size = state_compress(gbemu.sst_state, size, gbemu.sst_out,
+                          gbemu.sst_out_max);
+    if (!size) return false;
+    char* sst_filename = gbemu.cart->sst_filename;
+    strcpy(gbemu.sst_tmp_filename + strlen(sst_filename), ".XXXXXX");
+    int fd = mkstemp(gbemu.sst_tmp_filename);
+    if (fd < 0) return false;
+    // mkstemp leaves it readable by the owner only
+    fchmod(fd, 0644);
+    FILE* tmp_file = fdopen(fd, "wb");
+    if (!tmp_file) {
+        close(fd);
+        remove(gbemu.sst_tmp_filename);
+        return false;
+    }
+    bool ok = fwrite(gbemu.sst_out, 1, size, tmp_file) == size &&
+              !fflush(tmp_file) && !fsync(fileno(tmp_file));
+    ok &= !fclose(tmp_file);
+    if (ok) ok = !rename(gbemu.sst_tmp_filename, sst_filename);
+    if (!ok) remove(gbemu.sst_tmp_filename);
+    return ok;
+}
+
+static int sst_thread_main(void* data) {
+    SDL_LockMutex(gbemu.sst_lock);
+    while (true) {
+        while (!gbemu.sst_size && !gbemu.sst_quit) {
+            SDL_CondWait(gbemu.sst_cond, gbemu.sst_lock);
+        }
+        if (!gbemu.sst_size) break;
+        size_t size = gbemu.sst_size;
+        SDL_UnlockMutex(gbemu.sst_lock);
+        bool ok = write_state(size);
+        atomic_store(&gbemu.sst_result, ok ? SST_SAVED : SST_FAILED);
+        SDL_LockMutex(gbemu.sst_lock);
+        gbemu.sst_size = 0;
+    }
+    SDL_UnlockMutex(gbemu.sst_lock);
+    return 0;
+}
+
+bool emu_start_thread() {
+    gbemu.emu_thread = SDL_CreateThread(emu_thread_main, "emulation", NULL);
+    gbemu.sst_thread =
+        SDL_CreateThread(sst_thread_main, "save state writer", NULL);
+    return gbemu.emu_thread && gbemu.sst_thread;
+}
+
 bool emu_load_rom(char* filename) {
     gbemu.cart = cart_create(filename);
     if (!gbemu.cart) {
@@ -157,81 +557,115 @@ bool emu_load_rom(char* filename) {
         return false;
     }
     emu_reset();
-    return true;
+    // snapshots are sized for the cartridge's ram
+    if (gbemu.rewind_mb &&
+        !rewind_init(&gbemu.rewind, gbemu.gb, gbemu.rewind_interval,
+                     (size_t) gbemu.rewind_mb << 20)) {
+        gbemu.rewind_mb = 0;
+    }
+
+    gbemu.sst_state_max = state_max_size(gbemu.gb, 0);
+    gbemu.sst_state = malloc(gbemu.sst_state_max);
+    gbemu.sst_out_max = state_max_size(gbemu.gb, STATE_COMPRESS);
+    gbemu.sst_out = malloc(gbemu.sst_out_max);
+    char* sst_filename = gbemu.cart->sst_filename;
+    // with room for the suffix mkstemp fills in
+    gbemu.sst_tmp_filename = malloc(strlen(sst_filename) + 8);
+    if (!gbemu.sst_tmp_filename) return false;
+    strcpy(gbemu.sst_tmp_filename, sst_filename);
+    return gbemu.sst_state && gbemu.sst_out;
 }
 
 void emu_reset() {
     reset_gb(gbemu.gb, gbemu.cart);
+    gbemu.gb->ppu.screen = gbemu.frames[gbemu.back];
     gbemu.frame = 0;
     gbemu.paused = false;
+    rewind_clear(&gbemu.rewind);
 }
 
-/*
-save state format:
-16byte cartridge header
-contents of gb struct
-cartridge state
-cartridge ram (if any)
-cartridge rtc (if any)
-and this is all compressed in gzip format
-*/
-
+// takes a copy of the state for the writer thread. a save made while the
+// last one is still being written is dropped
 void save_state() {
-    gzFile sst_file = gzopen(gbemu.cart->sst_filename, "wb");
-    gzfwrite(gbemu.cart->title, sizeof gbemu.cart->title, 1, sst_file);
-
-    gbemu.gb->cart = NULL;
-    gbemu.gb->cpu.master = NULL;
-    gbemu.gb->ppu.master = NULL;
-    gbemu.gb->apu.master = NULL;
-    gzfwrite(gbemu.gb, sizeof *gbemu.gb, 1, sst_file);
-    gbemu.gb->cart = gbemu.cart;
-    gbemu.gb->cpu.master = gbemu.gb;
-    gbemu.gb->ppu.master = gbemu.gb;
-    gbemu.gb->apu.master = gbemu.gb;
-
-    gzfwrite(&gbemu.cart->st, sizeof gbemu.cart->st, 1, sst_file);
-    if (gbemu.cart->ram_banks)
-        gzfwrite(gbemu.cart->ram, SRAM_BANK_SIZE, gbemu.cart->ram_banks,
-                 sst_file);
-    if (gbemu.cart->has_rtc)
-        gzfwrite(gbemu.cart->rtc, sizeof *gbemu.cart->rtc, 1, sst_file);
-
-    gzclose(sst_file);
-}
-
-void load_state() {
-    gzFile sst_file = gzopen(gbemu.cart->sst_filename, "rb");
+    SDL_LockMutex(gbemu.sst_lock);
+    bool busy = gbemu.sst_size;
+    if (!busy) {
+        gbemu.sst_size = save_state_to_buffer(gbemu.gb, gbemu.sst_state,
+                                              gbemu.sst_state_max, 0);
+        SDL_CondSignal(gbemu.sst_cond);
+    }
+    SDL_UnlockMutex(gbemu.sst_lock);
+    if (busy) printf("save state skipped, still writing the last one\n");
+}
+
+// ui thread. tells how the last save state write went
+void emu_report_save() {
+    switch (atomic_exchange(&gbemu.sst_result, SST_IDLE)) {
+        case SST_SAVED:
+            printf("saved state to %s\n", gbemu.cart->sst_filename);
+            break;
+        case SST_FAILED:
+            SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "gbemu",
+                                     "Error writing Save State!",
+                                     gbemu.main_window);
+            break;
+        default:
+            break;
+    }
+}
+
+bool load_state() {
+    FILE* sst_file = fopen(gbemu.cart->sst_filename, "rb");
     if (!sst_file) {
-        gzclose(sst_file);
         SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "gbemu",
                                  "No Save State!", gbemu.main_window);
-        return;
+        return false;
     }
-
-    u8 title[0x10];
-    gzfread(title, sizeof gbemu.cart->title, 1, sst_file);
-    if (memcmp(title, gbemu.cart->title, sizeof title)) {
-        gzclose(sst_file);
+    fseek(sst_file, 0, SEEK_END);
+    long size = ftell(sst_file);
+    fseek(sst_file, 0, SEEK_SET);
+    u8* buf = malloc(size > 0 ? size : 1);
+    bool ok = size > 0 && fread(buf, 1, size, sst_file) == size &&
+              load_state_from_buffer(gbemu.gb, buf, size);
+    fclose(sst_file);
+    free(buf);
+    if (!ok) {
         SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "gbemu",
                                  "Invalid Save State!", gbemu.main_window);
-        return;
+        return false;
     }
 
-    gzfread(gbemu.gb, sizeof *gbemu.gb, 1, sst_file);
-    gbemu.gb->cart = gbemu.cart;
-    gbemu.gb->cpu.master = gbemu.gb;
-    gbemu.gb->ppu.master = gbemu.gb;
-    gbemu.gb->apu.master = gbemu.gb;
-
-    gzfread(&gbemu.cart->st, sizeof gbemu.cart->st, 1, sst_file);
-    if (gbemu.cart->ram_banks)
-        gzfread(gbemu.cart->ram, SRAM_BANK_SIZE, gbemu.cart->ram_banks,
-                sst_file);
-    if (gbemu.cart->has_rtc)
-        gzfread(gbemu.cart->rtc, sizeof *gbemu.cart->rtc, 1, sst_file);
+    rewind_clear(&gbemu.rewind);
+    update_texture();
+    return true;
+}
 
-    gzclose(sst_file);
+/*
+records from power-on, or from the save state with from_state, or plays a
+movie back from the state it starts from. call before the emulation thread is
+started
+*/
+bool emu_start_movie(char* filename, bool record, bool from_state) {
+    emu_reset();
+    bool ok;
+    if (!record) {
+        ok = movie_play(&gbemu.movie, gbemu.gb, filename);
+    } else if (!from_state || load_state()) {
+        ok = movie_record(&gbemu.movie, gbemu.gb, filename,
+                          from_state ? 0 : MOVIE_POWER_ON);
+    } else {
+        return false;
+    }
+    if (!ok) {
+        SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "gbemu",
+                                 record ? "Error creating movie!"
+                                        : "Invalid movie!",
+                                 gbemu.main_window);
+    }
+    return ok;
+}
 
-    update_texture();
+void emu_stop_movie() {
+    if (gbemu.movie.mode == MOVIE_OFF) return;
+    close_movie(gbemu.movie.mode == MOVIE_RECORDING ? "recorded" : "stopped");
 }
\ No newline at end of file
@@ -2,48 +2,130 @@
 #define EMULATOR_H
 
 #include <SDL2/SDL.h>
+#include <stdatomic.h>
 
 #include "cartridge.h"
 #include "gb.h"
+#include "movie.h"
+#include "pace.h"
+#include "rewind.h"
+#include "ring.h"
 #include "types.h"
 
+// frames the audio device asks for at a time
+#define AUDIO_DEVICE_FRAMES 256
+#define AUDIO_RING_FRAMES 8192
+#define AUDIO_LATENCY_MS 25
+// how far the resampling ratio may be pulled to hold the latency target
+#define AUDIO_MAX_RATE_DELTA 0.005
+
+#define REWIND_INTERVAL 2
+#define REWIND_MB 32
+
+// set in frame_ready along with the index when the frame has not been shown
+#define FRAME_FRESH 4
+
+// how the last save state write went, for the ui thread to report
+enum { SST_IDLE, SST_SAVED, SST_FAILED };
+
 struct emulator {
     SDL_Window* main_window;
     SDL_Renderer* main_renderer;
 
     SDL_Texture* gb_screen;
+
+    /*
+    the ppu draws into frames[back] on the emulation thread and the ui thread
+    shows frames[front]. a finished frame is swapped with the one in
+    frame_ready, so neither side ever waits on the other or copies a frame
+    */
+    u32 frames[3][GB_SCREEN_H][GB_SCREEN_W];
+    int back;
+    int front;
+    atomic_int frame_ready;
+
+    SDL_Thread* emu_thread;
+    // held by whichever thread is touching the gb
+    SDL_mutex* lock;
+    atomic_bool quit;
+
     SDL_AudioDeviceID gb_audio;
+    int audio_freq;
+    // samples go from the emulator to the audio callback through audio_ring,
+    // which is kept around audio_latency_ms full
+    struct audio_ring audio_ring;
+    int audio_latency_ms;
+    double audio_fill_avg;
+    double audio_rate_adj;
+
+    enum pace_mode pace_mode;
+    struct pacer pacer;
     SDL_GameController* controller;
 
     struct gb* gb;
     struct cartridge* cart;
 
+    // snapshots for going back while the rewind key is held. off if
+    // rewind_mb is 0
+    struct rewind rewind;
+    int rewind_interval;
+    int rewind_mb;
+    bool rewinding;
+
+    // input recorded or played back a frame at a time, along with state
+    // hashes. anything that moves the gb elsewhere stops it
+    struct movie movie;
+
+    /*
+    a save copies the state into sst_state and leaves compressing and writing
+    it to sst_thread, so it never holds up a frame. sst_size is the size of
+    the state waiting there, or 0 once the writer is done with it
+    */
+    SDL_Thread* sst_thread;
+    SDL_mutex* sst_lock;
+    SDL_cond* sst_cond;
+    u8* sst_state;
+    size_t sst_state_max;
+    u8* sst_out;
+    size_t sst_out_max;
+    char* sst_tmp_filename;
+    size_t sst_size;
+    bool sst_quit;
+    atomic_int sst_result;
+
     unsigned long frame;
 
     bool paused;
     bool muted;
 
-    bool force_dmg;
-    Uint32 dmg_colors[4];
-
     bool speedup;
     int speedup_speed;
-    int speed;
 };
 
 extern struct emulator gbemu;
 
-bool emulator_init();
+bool emulator_init(int audio_latency_ms, enum pace_mode pace_mode,
+                   int rewind_interval, int rewind_mb);
 void emulator_quit();
 
 void emu_handle_event(SDL_Event e);
+bool emu_start_thread();
+bool emu_take_frame();
+void update_texture();
 
 void emu_run_frame(bool video, bool audio);
+u32 emu_audio_target();
+void emu_pause_audio(bool pause);
+void emu_pace(u64 cycles);
 
 bool emu_load_rom(char* filename);
 void emu_reset();
 
 void save_state();
-void load_state();
+bool load_state();
+void emu_report_save();
+
+bool emu_start_movie(char* filename, bool record, bool from_state);
+void emu_stop_movie();
 
 #endif
\ No newline at end of file
@@ -1,12 +1,25 @@
 #include "gb.h"
 
-#include <SDL2/SDL.h>
-
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "cartridge.h"
-#include "emulator.h"
+#include "profile.h"
+
+// the apu only catches up when the cpu touches its registers
+static void sync_apu(struct gb* gb) {
+    PROF_SECTION(PROF_APU);
+    apu_sync(&gb->apu, gb->sched.now);
+    PROF_SECTION(PROF_CPU);
+}
+
+// the same goes for the ppu and the registers and memory it reads
+static void sync_ppu(struct gb* gb) {
+    PROF_SECTION(PROF_PPU);
+    ppu_sync(&gb->ppu, gb->sched.now);
+    PROF_SECTION(PROF_CPU);
+}
 
 u8 read8(struct gb* bus, u16 addr) {
     if (addr < 0x4000) {
@@ -42,7 +55,9 @@ u8 read8(struct gb* bus, u16 addr) {
         return 0xff;
     }
     if (addr < 0xff4d) {
-        if ((addr & 0x00ff) == DIV) return bus->div >> 8;
+        if ((addr & 0x00ff) == DIV) return get_div(bus, bus->sched.now) >> 8;
+        if ((addr & 0x00ff) == TIMA) sync_timers(bus, bus->sched.now);
+        if (NR10 <= (addr & 0x00ff) && (addr & 0x00ff) < LCDC) sync_apu(bus);
         if ((addr & 0x00f0) == WAVERAM) {
             if (bus->apu.ch3_enable) return 0xff;
             else return (bus->io + WAVERAM)[addr & 0x000f];
@@ -51,6 +66,9 @@ u8 read8(struct gb* bus, u16 addr) {
     }
     if (addr < 0xff80) { // cgb registers
         if (bus->cgb_mode) {
+            if ((addr & 0x00ff) == PCM12 || (addr & 0x00ff) == PCM34) {
+                sync_apu(bus);
+            }
             if ((addr & 0x00ff) == BCPD) {
                 if (!(bus->io[LCDC] & LCDC_ENABLE) ||
                     (bus->io[STAT] & STAT_MODE) != 3) {
@@ -75,19 +93,23 @@ u8 read8(struct gb* bus, u16 addr) {
 
 void write8(struct gb* bus, u16 addr, u8 data) {
     if (addr < 0x4000) {
-        cart_write(bus->cart, addr, CART_ROM0, data);
+        cart_write(bus->cart, addr, CART_ROM0, data, bus->cycles);
+        update_mem_map(bus);
         return;
     }
     if (addr < 0x8000) {
-        cart_write(bus->cart, addr & 0x3fff, CART_ROM1, data);
+        cart_write(bus->cart, addr & 0x3fff, CART_ROM1, data, bus->cycles);
+        update_mem_map(bus);
         return;
     }
     if (addr < 0xa000) {
+        sync_ppu(bus);
         bus->vram[bus->io[VBK] & 1][addr & 0x1fff] = data;
+        ppu_vram_written(&bus->ppu, bus->io[VBK] & 1, addr);
         return;
     }
     if (addr < 0xc000) {
-        cart_write(bus->cart, addr & 0x1fff, CART_RAM, data);
+        cart_write(bus->cart, addr & 0x1fff, CART_RAM, data, bus->cycles);
         return;
     }
     if (addr < 0xd000) {
@@ -109,6 +131,7 @@ void write8(struct gb* bus, u16 addr, u8 data) {
         return;
     }
     if (addr < 0xfea0) {
+        sync_ppu(bus);
         bus->oam[addr - 0xfe00] = data;
         return;
     }
@@ -116,6 +139,7 @@ void write8(struct gb* bus, u16 addr, u8 data) {
         return;
     }
     if (addr < 0xff80) {
+        if (NR10 <= (addr & 0x00ff) && (addr & 0x00ff) < LCDC) sync_apu(bus);
         if (!bus->apu.ch3_enable && (addr & 0x00f0) == WAVERAM) {
             (bus->io + WAVERAM)[addr & 0x000f] = data;
             return;
@@ -124,18 +148,24 @@ void write8(struct gb* bus, u16 addr, u8 data) {
             case JOYP:
                 bus->io[JOYP] =
                     (bus->io[JOYP] & 0b11001111) | (data & 0b00110000);
+                gb_update_input(bus);
                 break;
             case DIV:
-                bus->div = 0x0000;
+                reset_div(bus);
                 break;
             case TIMA:
+                sync_timers(bus, bus->sched.now);
                 bus->io[TIMA] = data;
+                timer_event(bus, bus->sched.now);
                 break;
             case TMA:
+                sync_timers(bus, bus->sched.now);
                 bus->io[TMA] = data;
                 break;
             case TAC:
+                sync_timers(bus, bus->sched.now);
                 bus->io[TAC] = data & 0b0111;
+                timer_event(bus, bus->sched.now);
                 break;
             case IF:
                 bus->io[IF] = (data & 0b00011111) | 0b11100000;
@@ -251,38 +281,46 @@ void write8(struct gb* bus, u16 addr, u8 data) {
                 bus->io[NR52] = data & 0b10000000;
                 break;
             case LCDC:
+                sync_ppu(bus);
                 bus->io[LCDC] = data;
+                update_vram_map(bus);
+                sched_add(&bus->sched, EV_PPU, bus->sched.now + 1);
                 break;
             case STAT:
                 bus->io[STAT] =
                     (bus->io[STAT] & 0b000111) | (data & 0b01111000);
+                sched_add(&bus->sched, EV_STAT, bus->sched.now + 1);
                 break;
             case SCY:
+                sync_ppu(bus);
                 bus->io[SCY] = data;
                 break;
             case SCX:
+                sync_ppu(bus);
                 bus->io[SCX] = data;
                 break;
             case LYC:
                 bus->io[LYC] = data;
+                sched_add(&bus->sched, EV_STAT, bus->sched.now + 1);
                 break;
             case DMA:
                 bus->io[DMA] = data;
                 bus->dma_start = 1;
+                sched_add(&bus->sched, EV_DMA, bus->sched.now + 4);
                 break;
             case BGP:
-                bus->io[BGP] = data;
-                break;
             case OBP0:
-                bus->io[OBP0] = data;
-                break;
             case OBP1:
-                bus->io[OBP1] = data;
+                sync_ppu(bus);
+                bus->io[addr & 0x00ff] = data;
+                ppu_update_dmg_palette(&bus->ppu, (addr & 0x00ff) - BGP);
                 break;
             case WY:
+                sync_ppu(bus);
                 bus->io[WY] = data;
                 break;
             case WX:
+                sync_ppu(bus);
                 bus->io[WX] = data;
                 break;
             default:
@@ -293,6 +331,7 @@ void write8(struct gb* bus, u16 addr, u8 data) {
                             break;
                         case VBK:
                             bus->io[VBK] = ~1 | (data & 1);
+                            update_vram_map(bus);
                             break;
                         case HDMA1:
                             bus->hdma_src =
@@ -311,6 +350,8 @@ void write8(struct gb* bus, u16 addr, u8 data) {
                                 (bus->hdma_dest & 0xff00) | (data & 0xf0);
                             break;
                         case HDMA5:
+                            // the ppu starts hblank transfers
+                            sync_ppu(bus);
                             if (!bus->hdma_active) {
                                 bus->hdma_active = true;
                                 bus->hdma_hblank = data & (1 << 7);
@@ -325,14 +366,19 @@ void write8(struct gb* bus, u16 addr, u8 data) {
                                 bus->hdma_active = false;
                                 bus->io[HDMA5] &= 1 << 7;
                             }
+                            schedule_hdma(bus, bus->sched.now + 1);
+                            sched_add(&bus->sched, EV_PPU, bus->sched.now + 1);
                             break;
                         case BCPS:
                             bus->io[BCPS] = data;
                             break;
                         case BCPD:
+                            sync_ppu(bus);
                             if (!(bus->io[LCDC] & LCDC_ENABLE) ||
                                 (bus->io[STAT] & STAT_MODE) != 3) {
                                 bus->bg_cram[bus->io[BCPS] & CPS_ADDR] = data;
+                                ppu_update_cgb_color(&bus->ppu, false,
+                                                     bus->io[BCPS] & CPS_ADDR);
                             }
 
                             if (bus->io[BCPS] & CPS_INC) {
@@ -344,9 +390,12 @@ void write8(struct gb* bus, u16 addr, u8 data) {
                             bus->io[OCPS] = data;
                             break;
                         case OCPD:
+                            sync_ppu(bus);
                             if (!(bus->io[LCDC] & LCDC_ENABLE) ||
                                 (bus->io[STAT] & STAT_MODE) != 3) {
                                 bus->obj_cram[bus->io[OCPS] & CPS_ADDR] = data;
+                                ppu_update_cgb_color(&bus->ppu, true,
+                                                     bus->io[OCPS] & CPS_ADDR);
                             }
                             if (bus->io[OCPS] & CPS_INC) {
                                 bus->io[OCPS]++;
@@ -357,11 +406,15 @@ void write8(struct gb* bus, u16 addr, u8 data) {
                             bus->io[OPRI] = data & 1;
                         case SVBK:
                             bus->io[SVBK] = data & 0b111;
+                            update_mem_map(bus);
                             break;
                     }
                 }
                 break;
         }
+        if (NR10 <= (addr & 0x00ff) && (addr & 0x00ff) < LCDC) {
+            apu_update_outputs(&bus->apu);
+        }
         return;
     }
     if (addr < 0xffff) {
@@ -371,27 +424,109 @@ void write8(struct gb* bus, u16 addr, u8 data) {
     if (addr == 0xffff) bus->IE = (data & 0b00011111) | 0b11100000;
 }
 
-void gb_m_cycle(struct gb* gb) {
+// rebuilds the page tables, needed after any bank switch or change to oam dma
+void update_mem_map(struct gb* gb) {
+    u8* rom0 = cart_bank(gb->cart, CART_ROM0);
+    u8* rom1 = cart_bank(gb->cart, CART_ROM1);
+    u8* sram = cart_bank(gb->cart, CART_RAM);
+    u8 bank = gb->io[SVBK];
+
     for (int i = 0; i < 4; i++) {
-        check_stat_irq(gb);
-        clock_timers(gb);
-        update_joyp(gb);
-        if (!(gb->io[KEY1] & (1 << 7)) || i % 2 == 0) {
-            ppu_clock(&gb->ppu);
-        }
-        apu_clock(&gb->apu);
-        if (gb->hdma_active && i % 2 == 0 &&
-            (!(gb->io[KEY1] & (1 << 7)) || i % 4 == 0)) {
-            run_hdma(gb);
-        }
+        gb->read_map[i] = rom0 ? rom0 + i * MEM_PAGE_SIZE : NULL;
+        gb->read_map[4 + i] = rom1 ? rom1 + i * MEM_PAGE_SIZE : NULL;
     }
-    if (gb->dma_start == 1) gb->dma_start++;
-    else if(gb->dma_start == 2) {
-        gb->dma_start = 0;
-        gb->dma_active = true;
-        gb->dma_index = 0;
+    for (int i = 0; i < 2; i++) {
+        gb->read_map[0xa + i] = sram ? sram + i * MEM_PAGE_SIZE : NULL;
     }
-    if (gb->dma_active) run_dma(gb);
+    gb->read_map[0xc] = gb->wram[0];
+    gb->read_map[0xd] = gb->wram[bank ? bank : 1];
+    gb->read_map[0xe] = gb->wram[0];
+    // oam, io and hram
+    gb->read_map[0xf] = NULL;
+
+    // rom writes go to the mbc and vram writes have to sync the ppu, so only
+    // ram is written directly
+    memset(gb->write_map, 0, sizeof gb->write_map);
+    if (!gb->dma_active) {
+        for (int i = 0xa; i < 0xf; i++) gb->write_map[i] = gb->read_map[i];
+    }
+    if (gb->write_map[0xa]) cart_ram_mapped(gb->cart, gb->write_map[0xa]);
+
+    update_vram_map(gb);
+}
+
+// vram is mapped for reads unless the ppu has it locked in mode 3
+void update_vram_map(struct gb* gb) {
+    if ((gb->io[LCDC] & LCDC_ENABLE) && (gb->io[STAT] & STAT_MODE) == 3) {
+        gb->read_map[0x8] = NULL;
+        gb->read_map[0x9] = NULL;
+    } else {
+        u8* vram = gb->vram[gb->io[VBK] & 1];
+        gb->read_map[0x8] = vram;
+        gb->read_map[0x9] = vram + MEM_PAGE_SIZE;
+    }
+}
+
+void gb_m_cycle(struct gb* gb) {
+    gb->cycles += (gb->io[KEY1] & (1 << 7)) ? 2 : 4;
+    gb->sched.now += 4;
+    if (gb->sched.now >= gb->sched.next) sched_run(gb);
+}
+
+/*
+while the cpu is halted or stopped with no interrupt pending, only scheduled
+events can change anything, so the m-cycles before the next one can be
+skipped without running them. everything else is lazy and catches up when it
+is next looked at. end is a cycle count not to skip past
+*/
+void gb_skip_halt(struct gb* gb, u64 end) {
+    struct sm83* cpu = &gb->cpu;
+    if (!(cpu->halt || cpu->stop) || cpu->ei || cpu->ill || gb->hdma_index ||
+        (gb->IE & gb->io[IF] & 0b00011111))
+        return;
+    if (gb->cycles >= end) return;
+
+    u64 step = (gb->io[KEY1] & (1 << 7)) ? 2 : 4;
+    // m-cycles up to and including the one the next event runs in
+    u64 n = (gb->sched.next - gb->sched.now + 3) / 4;
+    u64 n_end = (end - gb->cycles - 1) / step + 1;
+    if (n > n_end) n = n_end;
+    if (n <= 1) return;
+
+    gb->sched.now += 4 * (n - 1);
+    gb->cycles += step * (n - 1);
+}
+
+// true if the ppu completed the frame. the apu is left to gb_end_frame
+bool gb_run_frame(struct gb* gb) {
+    // with the lcd off no frame is ever completed, so cap each frame at the
+    // number of cycles a frame would take
+    u64 end = gb->cycles + CYCLES_PER_FRAME;
+    while (!gb->ppu.frame_complete && gb->cycles < end && !gb->cpu.ill) {
+        if (gb->cfg.halt_skip) gb_skip_halt(gb, end);
+        cpu_clock(&gb->cpu);
+    }
+    // a frame cut short by the cap still shows what was drawn so far
+    if (!gb->ppu.frame_complete) sync_ppu(gb);
+    bool complete = gb->ppu.frame_complete;
+    gb->ppu.frame_complete = false;
+    cart_end_frame(gb->cart, gb->write_map[0xa], gb->cycles);
+    return complete;
+}
+
+// makes the audio of the frame just run readable
+void gb_end_frame(struct gb* gb) {
+    sync_apu(gb);
+    apu_end_frame(&gb->apu);
+}
+
+// the ppu and apu are caught up first so the change only applies from now
+void gb_set_render_skip(struct gb* gb, u8 skip) {
+    if (skip == gb->cfg.render_skip) return;
+    sync_ppu(gb);
+    sync_apu(gb);
+    gb->cfg.render_skip = skip;
+    apu_update_outputs(&gb->apu);
 }
 
 void check_stat_irq(struct gb* gb) {
@@ -409,16 +544,44 @@ void check_stat_irq(struct gb* gb) {
     gb->prev_stat_int = new_stat_int;
 }
 
-void clock_timers(struct gb* gb) {
-    gb->div++;
+u16 get_div(struct gb* gb, u64 time) {
+    return time - gb->div_base;
+}
+
+void reset_div(struct gb* gb) {
+    // the apu is clocked off div
+    apu_sync(&gb->apu, gb->sched.now);
+    sync_timers(gb, gb->sched.now);
+    gb->div_base = gb->sched.now;
+    timer_event(gb, gb->sched.now);
+    apu_schedule(&gb->apu, gb->sched.now);
+}
+
+void switch_speed(struct gb* gb) {
+    // the ppu and hdma run on different t-cycles in double speed mode
+    sync_ppu(gb);
+    apu_sync(&gb->apu, gb->sched.now);
+    gb->io[KEY1] = ~gb->io[KEY1] & (1 << 7);
+    ppu_schedule(&gb->ppu);
+    schedule_hdma(gb, gb->sched.now + 1);
+    apu_schedule(&gb->apu, gb->sched.now);
+}
+
+static const int timer_freq[] = {1024, 16, 64, 256};
+
+static bool timer_inc(struct gb* gb, u64 time) {
+    return (gb->io[TAC] & 0b100) &&
+           (get_div(gb, time) & timer_freq[gb->io[TAC] & 0b011] / 2);
+}
+
+static void clock_timers(struct gb* gb) {
+    gb->timer_time++;
     if (gb->timer_overflow) {
         gb->io[IF] |= I_TIMER;
         gb->io[TIMA] = gb->io[TMA];
         gb->timer_overflow = false;
     }
-    static const int freq[] = {1024, 16, 64, 256};
-    bool new_timer_inc =
-        (gb->io[TAC] & 0b100) && (gb->div & (freq[gb->io[TAC] & 0b011]) / 2);
+    bool new_timer_inc = timer_inc(gb, gb->timer_time);
     if (!new_timer_inc && gb->prev_timer_inc) {
         gb->io[TIMA]++;
         if (gb->io[TIMA] == 0) {
@@ -428,6 +591,56 @@ void clock_timers(struct gb* gb) {
     gb->prev_timer_inc = new_timer_inc;
 }
 
+// first falling edge of the selected div bit after the given t-cycle
+static u64 next_timer_edge(struct gb* gb, u64 time) {
+    int freq = timer_freq[gb->io[TAC] & 0b011];
+    return time + freq - get_div(gb, time) % freq;
+}
+
+void sync_timers(struct gb* gb, u64 time) {
+    while (gb->timer_time < time) {
+        // a reload or an edge caused by a write is done a t-cycle at a time
+        if (gb->timer_overflow ||
+            gb->prev_timer_inc != timer_inc(gb, gb->timer_time)) {
+            clock_timers(gb);
+            continue;
+        }
+        if (!(gb->io[TAC] & 0b100)) {
+            gb->timer_time = time;
+            break;
+        }
+        int freq = timer_freq[gb->io[TAC] & 0b011];
+        u64 edge = next_timer_edge(gb, gb->timer_time);
+        u64 edges = edge <= time ? (time - edge) / freq + 1 : 0;
+        if (gb->io[TIMA] + edges < 0x100) {
+            gb->io[TIMA] += edges;
+            gb->timer_time = time;
+            gb->prev_timer_inc = timer_inc(gb, time);
+            break;
+        }
+        gb->timer_time = edge + (0xff - gb->io[TIMA]) * freq;
+        gb->io[TIMA] = 0;
+        gb->timer_overflow = true;
+        gb->prev_timer_inc = false;
+    }
+}
+
+// syncs the timers and schedules the next reload of tima
+void timer_event(struct gb* gb, u64 time) {
+    sync_timers(gb, time);
+    if (gb->timer_overflow ||
+        gb->prev_timer_inc != timer_inc(gb, gb->timer_time)) {
+        sched_add(&gb->sched, EV_TIMER, gb->timer_time + 1);
+    } else if (gb->io[TAC] & 0b100) {
+        int freq = timer_freq[gb->io[TAC] & 0b011];
+        u64 edge = next_timer_edge(gb, gb->timer_time);
+        sched_add(&gb->sched, EV_TIMER,
+                  edge + (0xff - gb->io[TIMA]) * freq + 1);
+    } else {
+        sched_cancel(&gb->sched, EV_TIMER);
+    }
+}
+
 void update_joyp(struct gb* gb) {
     u8 buttons = 0b11110000;
     if (!(gb->io[JOYP] & JP_DIR)) {
@@ -443,9 +656,15 @@ void update_joyp(struct gb* gb) {
     gb->io[JOYP] = (gb->io[JOYP] & 0b11110000) | buttons;
 }
 
+// call after changing jp_dir or jp_action
+void gb_update_input(struct gb* gb) {
+    sched_add(&gb->sched, EV_JOYP, gb->sched.now + 1);
+}
+
 void run_dma(struct gb* gb) {
     if (gb->dma_index == OAM_SIZE) {
         gb->dma_active = false;
+        update_mem_map(gb);
         return;
     }
     u16 addr = gb->io[DMA] << 8 | gb->dma_index;
@@ -454,6 +673,22 @@ void run_dma(struct gb* gb) {
     gb->oam[gb->dma_index++] = data;
 }
 
+void dma_event(struct gb* gb, u64 time) {
+    // the ppu reads oam and stops looking at it while dma is active
+    ppu_sync(&gb->ppu, time);
+    if (gb->dma_start == 1) gb->dma_start++;
+    else if (gb->dma_start == 2) {
+        gb->dma_start = 0;
+        gb->dma_active = true;
+        gb->dma_index = 0;
+        update_mem_map(gb);
+    }
+    if (gb->dma_active) run_dma(gb);
+    if (gb->dma_start || gb->dma_active) {
+        sched_add(&gb->sched, EV_DMA, time + 4);
+    }
+}
+
 void run_hdma(struct gb* gb) {
     if (gb->io[HDMA5] == 0xff) {
         gb->hdma_active = false;
@@ -471,6 +706,7 @@ void run_hdma(struct gb* gb) {
             gb->hdma_dest + 0x10 * gb->hdma_block + (0x10 - gb->hdma_index);
         if ((gb->io[STAT] & STAT_MODE) != 3) {
             gb->vram[gb->io[VBK] & 1][dest & 0x1fff] = data;
+            ppu_vram_written(&gb->ppu, gb->io[VBK] & 1, dest);
         }
 
         gb->hdma_index--;
@@ -483,15 +719,50 @@ void run_hdma(struct gb* gb) {
     }
 }
 
+// schedules the next hdma step at or after the given t-cycle, if there is
+// anything to do
+void schedule_hdma(struct gb* gb, u64 time) {
+    if (!gb->hdma_active || (!gb->hdma_index && gb->io[HDMA5] != 0xff)) {
+        sched_cancel(&gb->sched, EV_HDMA);
+        return;
+    }
+    // steps happen on the first and third t-cycle of each m-cycle, only on
+    // the first in double speed mode
+    u64 mask = (gb->io[KEY1] & (1 << 7)) ? 3 : 1;
+    sched_add(&gb->sched, EV_HDMA, ((time - 1 + mask) & ~mask) + 1);
+}
+
+void hdma_event(struct gb* gb, u64 time) {
+    // the ppu starts hblank transfers and its mode blocks vram writes
+    ppu_sync(&gb->ppu, time);
+    run_hdma(gb);
+    schedule_hdma(gb, time + 1);
+}
+
+void init_gb_config(struct gb_config* cfg) {
+    cfg->force_dmg = false;
+    cfg->speed = 1;
+    cfg->halt_skip = true;
+    cfg->sample_rate = 0;
+    cfg->render_skip = 0;
+    cfg->dmg_colors[0] = 0x00ffffff;
+    cfg->dmg_colors[1] = 0x0000e000;
+    cfg->dmg_colors[2] = 0x0009000;
+    cfg->dmg_colors[3] = 0x00000000;
+}
+
 void reset_gb(struct gb* gb, struct cartridge* cart) {
+    struct gb_config cfg = gb->cfg;
     memset(gb, 0x00, sizeof *gb);
+    gb->cfg = cfg;
     gb->cpu.master = gb;
     gb->ppu.master = gb;
     gb->apu.master = gb;
+    gb->ppu.screen = gb->ppu.frame;
     memset(&cart->st, 0x00, sizeof cart->st);
 
     gb->cart = cart;
-    if (gb->cart && gb->cart->cgb_compat && !gbemu.force_dmg) {
+    if (gb->cart && gb->cart->cgb_compat && !gb->cfg.force_dmg) {
         gb->cpu.A = 0x11;
         gb->cgb_mode = true;
     } else {
@@ -505,127 +776,14 @@ void reset_gb(struct gb* gb, struct cartridge* cart) {
     gb->io[IF] = 0xe0;
     gb->IE = 0xe0;
     gb->io[LCDC] |= LCDC_ENABLE;
-}
 
-void gb_handle_event(struct gb* gb, SDL_Event* e) {
-    if (e->type == SDL_KEYDOWN) {
-        switch (e->key.keysym.scancode) {
-            case SDL_SCANCODE_UP:
-                gb->jp_dir |= JP_U_SL;
-                break;
-            case SDL_SCANCODE_DOWN:
-                gb->jp_dir |= JP_D_ST;
-                break;
-            case SDL_SCANCODE_LEFT:
-                gb->jp_dir |= JP_L_B;
-                break;
-            case SDL_SCANCODE_RIGHT:
-                gb->jp_dir |= JP_R_A;
-                break;
-            case SDL_SCANCODE_Z:
-                gb->jp_action |= JP_R_A;
-                break;
-            case SDL_SCANCODE_X:
-                gb->jp_action |= JP_L_B;
-                break;
-            case SDL_SCANCODE_RSHIFT:
-                gb->jp_action |= JP_U_SL;
-                break;
-            case SDL_SCANCODE_RETURN:
-                gb->jp_action |= JP_D_ST;
-                break;
-            default:
-                break;
-        }
-    }
-    if (e->type == SDL_KEYUP) {
-        switch (e->key.keysym.scancode) {
-            case SDL_SCANCODE_UP:
-                gb->jp_dir &= ~JP_U_SL;
-                break;
-            case SDL_SCANCODE_DOWN:
-                gb->jp_dir &= ~JP_D_ST;
-                break;
-            case SDL_SCANCODE_LEFT:
-                gb->jp_dir &= ~JP_L_B;
-                break;
-            case SDL_SCANCODE_RIGHT:
-                gb->jp_dir &= ~JP_R_A;
-                break;
-            case SDL_SCANCODE_Z:
-                gb->jp_action &= ~JP_R_A;
-                break;
-            case SDL_SCANCODE_X:
-                gb->jp_action &= ~JP_L_B;
-                break;
-            case SDL_SCANCODE_RSHIFT:
-                gb->jp_action &= ~JP_U_SL;
-                break;
-            case SDL_SCANCODE_RETURN:
-                gb->jp_action &= ~JP_D_ST;
-                break;
-            default:
-                break;
-        }
-    }
-    if (e->type == SDL_CONTROLLERBUTTONDOWN) {
-        switch (e->cbutton.button) {
-            case SDL_CONTROLLER_BUTTON_DPAD_UP:
-                gb->jp_dir |= JP_U_SL;
-                break;
-            case SDL_CONTROLLER_BUTTON_DPAD_DOWN:
-                gb->jp_dir |= JP_D_ST;
-                break;
-            case SDL_CONTROLLER_BUTTON_DPAD_LEFT:
-                gb->jp_dir |= JP_L_B;
-                break;
-            case SDL_CONTROLLER_BUTTON_DPAD_RIGHT:
-                gb->jp_dir |= JP_R_A;
-                break;
-            case SDL_CONTROLLER_BUTTON_A:
-                gb->jp_action |= JP_R_A;
-                break;
-            case SDL_CONTROLLER_BUTTON_X:
-                gb->jp_action |= JP_L_B;
-                break;
-            case SDL_CONTROLLER_BUTTON_BACK:
-                gb->jp_action |= JP_U_SL;
-                break;
-            case SDL_CONTROLLER_BUTTON_START:
-                gb->jp_action |= JP_D_ST;
-                break;
-            default:
-                break;
-        }
-    }
-    if (e->type == SDL_CONTROLLERBUTTONUP) {
-        switch (e->cbutton.button) {
-            case SDL_CONTROLLER_BUTTON_DPAD_UP:
-                gb->jp_dir &= ~JP_U_SL;
-                break;
-            case SDL_CONTROLLER_BUTTON_DPAD_DOWN:
-                gb->jp_dir &= ~JP_D_ST;
-                break;
-            case SDL_CONTROLLER_BUTTON_DPAD_LEFT:
-                gb->jp_dir &= ~JP_L_B;
-                break;
-            case SDL_CONTROLLER_BUTTON_DPAD_RIGHT:
-                gb->jp_dir &= ~JP_R_A;
-                break;
-            case SDL_CONTROLLER_BUTTON_A:
-                gb->jp_action &= ~JP_R_A;
-                break;
-            case SDL_CONTROLLER_BUTTON_X:
-                gb->jp_action &= ~JP_L_B;
-                break;
-            case SDL_CONTROLLER_BUTTON_BACK:
-                gb->jp_action &= ~JP_U_SL;
-                break;
-            case SDL_CONTROLLER_BUTTON_START:
-                gb->jp_action &= ~JP_D_ST;
-                break;
-            default:
-                break;
-        }
-    }
-}
+    sched_reset(&gb->sched);
+    sched_add(&gb->sched, EV_STAT, 1);
+    sched_add(&gb->sched, EV_JOYP, 1);
+    ppu_schedule(&gb->ppu);
+    apu_schedule(&gb->apu, 0);
+    apu_set_sample_rate(&gb->apu, gb->cfg.sample_rate);
+    ppu_update_palettes(&gb->ppu);
+    ppu_invalidate_tiles(&gb->ppu);
+    update_mem_map(gb);
+}
\ No newline at end of file
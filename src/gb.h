@@ -4,6 +4,7 @@
 #include "apu.h"
 #include "cartridge.h"
 #include "ppu.h"
+#include "sched.h"
 #include "sm83.h"
 #include "types.h"
 
@@ -13,6 +14,8 @@
 #define IO_SIZE 0x80
 #define CRAM_SIZE (8 * 4 * 2)
 #define HRAM_SIZE 0x7f
+#define MEM_PAGE_SIZE 0x1000 // 4k
+#define MEM_PAGES 16
 
 enum {
     I_VBLANK = 1 << 0,
@@ -97,6 +100,25 @@ enum {
     PCM34 = 0x77 // ch3,4 output
 };
 
+// output the frontend does not need. timing, registers and interrupts are
+// kept exact either way
+enum {
+    SKIP_VIDEO = 1 << 0, // no tile fetches or pixel writes
+    SKIP_AUDIO = 1 << 1 // no mixing
+};
+
+struct gb_config {
+    bool force_dmg;
+    int speed;
+    u32 dmg_colors[4];
+    // jump a halted cpu straight to the next event
+    bool halt_skip;
+    // band-limited audio output rate, or 0 for point sampling into sample_buf
+    long sample_rate;
+    // SKIP_ flags. change with gb_set_render_skip once the gb is running
+    u8 render_skip;
+};
+
 struct gb {
     struct sm83 cpu;
     struct gb_ppu ppu;
@@ -104,8 +126,20 @@ struct gb {
 
     struct cartridge* cart;
 
+    // host memory behind each page of the address space as seen by the cpu,
+    // null where an access has to go through read8/write8
+    u8* read_map[MEM_PAGES];
+    u8* write_map[MEM_PAGES];
+
+    // kept across reset_gb and state loads
+    struct gb_config cfg;
+
     bool cgb_mode;
 
+    u64 cycles;
+
+    struct scheduler sched;
+
     u8 vram[2][VRAM_BANK_SIZE];
     u8 wram[8][WRAM_BANK_SIZE];
 
@@ -120,8 +154,9 @@ struct gb {
 
     u8 IE;
 
-    u16 div;
+    u64 div_base;
 
+    u64 timer_time;
     bool prev_timer_inc;
     bool timer_overflow;
 
@@ -145,16 +180,31 @@ struct gb {
 u8 read8(struct gb* bus, u16 addr);
 void write8(struct gb* bus, u16 addr, u8 data);
 
-void gb_handle_event(struct gb* gb, SDL_Event* e);
+void update_mem_map(struct gb* gb);
+void update_vram_map(struct gb* gb);
+
+u16 get_div(struct gb* gb, u64 time);
+void reset_div(struct gb* gb);
+void switch_speed(struct gb* gb);
 
 void check_stat_irq(struct gb* gb);
-void clock_timers(struct gb* gb);
+void sync_timers(struct gb* gb, u64 time);
+void timer_event(struct gb* gb, u64 time);
 void update_joyp(struct gb* gb);
+void gb_update_input(struct gb* gb);
 void run_dma(struct gb* gb);
+void dma_event(struct gb* gb, u64 time);
 void run_hdma(struct gb* gb);
+void schedule_hdma(struct gb* gb, u64 time);
+void hdma_event(struct gb* gb, u64 time);
 
 void gb_m_cycle(struct gb* gb);
+void gb_skip_halt(struct gb* gb, u64 end);
+bool gb_run_frame(struct gb* gb);
+void gb_end_frame(struct gb* gb);
+void gb_set_render_skip(struct gb* gb, u8 skip);
 
+void init_gb_config(struct gb_config* cfg);
 void reset_gb(struct gb* gb, struct cartridge* cart);
 
 #endif
\ No newline at end of file
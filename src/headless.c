@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cartridge.h"
+#include "gb.h"
+#include "instance.h"
+#include "movie.h"
+#include "ppu.h"
+#include "sm83.h"
+
+static double get_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(char* prog) {
+    fprintf(stderr,
+            "usage: %s [-f frames] [-c cycles] [-d] [-s] [-a rate] [-r] "
+            "[-n instances] [-j threads] [-m movie | -M movie] rom\n"
+            "  -f frames     run for this many frames (default 3600)\n"
+            "  -c cycles     run for this many cycles instead of frames\n"
+            "  -d            force dmg mode\n"
+            "  -s            step a halted cpu one m-cycle at a time\n"
+            "  -a rate       synthesize band-limited audio at this rate\n"
+            "  -r            skip rendering video and mixing audio\n"
+            "  -n instances  run this many instances of the rom (default 1)\n"
+            "  -j threads    worker threads to run instances on (default 1)\n"
+            "  -m movie      play a movie to its end, checking every frame\n"
+            "  -M movie      record the frames run from power-on to a movie\n",
+            prog);
+}
+
+static bool cycles_done(struct gb_instance* inst, u64 cycles) {
+    return inst->gb.cycles >= cycles || inst->gb.cpu.ill;
+}
+
+// plays or records a movie on one instance. false if a movie being played
+// went out of sync
+static bool run_movie(struct movie* mv, struct gb_instance* inst,
+                      unsigned long frames) {
+    while (!inst->gb.cpu.ill) {
+        if (mv->mode == MOVIE_RECORDING && mv->frame >= frames) break;
+        movie_start_frame(mv);
+        instance_run_frames(inst, 1);
+        enum movie_status status = movie_end_frame(mv);
+        if (status == MOVIE_DESYNC) {
+            fprintf(stderr, "movie out of sync after %lu frames\n",
+                    mv->frame);
+            return false;
+        }
+        if (status == MOVIE_END) break;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    unsigned long frames = 3600;
+    u64 cycles = 0;
+    int n_instances = 1;
+    int n_threads = 1;
+    char* movie_filename = NULL;
+    bool record = false;
+    struct gb_config cfg;
+    init_gb_config(&cfg);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:c:dsa:rn:j:m:M:")) != -1) {
+        switch (opt) {
+            case 'f':
+                frames = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                cycles = strtoull(optarg, NULL, 0);
+                break;
+            case 'd':
+                cfg.force_dmg = true;
+                break;
+            case 's':
+                cfg.halt_skip = false;
+                break;
+            case 'a':
+                cfg.sample_rate = atol(optarg);
+                break;
+            case 'r':
+                cfg.render_skip = SKIP_VIDEO | SKIP_AUDIO;
+                break;
+            case 'n':
+                n_instances = atoi(optarg);
+                break;
+            case 'j':
+                n_threads = atoi(optarg);
+                break;
+            case 'm':
+            case 'M':
+                movie_filename = optarg;
+                record = opt == 'M';
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    if (optind >= argc || n_instances < 1 ||
+        (movie_filename && n_instances > 1)) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    struct gb_pool* pool = pool_create(n_threads);
+    if (!pool) {
+        fprintf(stderr, "error creating worker threads\n");
+        return -1;
+    }
+
+    char** rom_filenames = malloc(n_instances * sizeof *rom_filenames);
+    struct gb_instance** insts = malloc(n_instances * sizeof *insts);
+    if (!rom_filenames || !insts) {
+        fprintf(stderr, "out of memory\n");
+        pool_destroy(pool);
+        return -1;
+    }
+    for (int i = 0; i < n_instances; i++) rom_filenames[i] = argv[optind];
+    if (!pool_create_instances(pool, rom_filenames, n_instances, &cfg,
+                               insts)) {
+        fprintf(stderr, "error loading rom %s\n", argv[optind]);
+        pool_destroy_instances(pool, insts, n_instances);
+        pool_destroy(pool);
+        return -1;
+    }
+
+    struct movie mv;
+    if (movie_filename &&
+        !(record ? movie_record(&mv, &insts[0]->gb, movie_filename,
+                                MOVIE_POWER_ON)
+                 : movie_play(&mv, &insts[0]->gb, movie_filename))) {
+        fprintf(stderr, "error %s movie %s\n", record ? "creating" : "loading",
+                movie_filename);
+        pool_destroy_instances(pool, insts, n_instances);
+        pool_destroy(pool);
+        return -1;
+    }
+
+    double start = get_time();
+    bool in_sync = true;
+    if (movie_filename) {
+        in_sync = run_movie(&mv, insts[0], frames);
+    } else if (cycles) {
+        // step the instances that have not reached the target a frame at a
+        // time, since each one gets there after a different number of frames
+        struct gb_instance** running = malloc(n_instances * sizeof *running);
+        while (true) {
+            int n_running = 0;
+            for (int i = 0; i < n_instances; i++) {
+                if (!cycles_done(insts[i], cycles)) {
+                    running[n_running++] = insts[i];
+                }
+            }
+            if (!n_running) break;
+            pool_run_frames(pool, running, n_running, 1);
+        }
+        free(running);
+    } else {
+        pool_run_frames(pool, insts, n_instances, frames);
+    }
+    double elapsed = get_time() - start;
+
+    unsigned long total_frames = 0;
+    u64 total_cycles = 0;
+    bool ill = false;
+    for (int i = 0; i < n_instances; i++) {
+        total_frames += insts[i]->frame;
+        total_cycles += insts[i]->gb.cycles;
+        ill |= insts[i]->gb.cpu.ill;
+    }
+    if (ill) fprintf(stderr, "illegal opcode reached\n");
+    unsigned long movie_frames = movie_filename ? mv.frame : 0;
+    if (movie_filename && !movie_close(&mv)) {
+        fprintf(stderr, "error writing movie %s\n", movie_filename);
+        in_sync = false;
+    }
+
+    printf("instances: %d\n", n_instances);
+    printf("threads: %d\n", n_threads);
+    printf("frames: %lu\n", total_frames);
+    printf("cycles: %llu\n", (unsigned long long) total_cycles);
+    if (movie_filename) {
+        printf("movie frames %s: %lu\n", record ? "recorded" : "checked",
+               movie_frames);
+    }
+    printf("time: %.3f s\n", elapsed);
+    printf("fps: %.1f\n", total_frames / elapsed);
+    printf("emulated MHz: %.2f (%.1fx realtime)\n",
+           total_cycles / elapsed / 1e6,
+           total_cycles / elapsed / GB_CLOCK_FREQ);
+    if (n_instances > 1) {
+        printf("fps per instance: %.1f\n", total_frames / elapsed / n_instances);
+    }
+
+    pool_destroy_instances(pool, insts, n_instances);
+    pool_destroy(pool);
+    free(insts);
+    free(rom_filenames);
+    return ill || !in_sync ? -1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,202 @@
+#include "instance.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+struct gb_instance* instance_create(char* rom_filename, struct gb_config* cfg) {
+    struct cartridge* cart = cart_create(rom_filename);
+    if (!cart) return NULL;
+    struct gb_instance* inst = malloc(sizeof *inst);
+    if (!inst) {
+        cart_destroy(cart);
+        return NULL;
+    }
+    inst->cart = cart;
+    if (cfg) inst->gb.cfg = *cfg;
+    else init_gb_config(&inst->gb.cfg);
+    reset_gb(&inst->gb, cart);
+    inst->frame = 0;
+    inst->frames_pending = 0;
+    return inst;
+}
+
+void instance_destroy(struct gb_instance* inst) {
+    if (!inst) return;
+    cart_destroy(inst->cart);
+    free(inst);
+}
+
+void instance_run_frames(struct gb_instance* inst, unsigned long frames) {
+    for (unsigned long i = 0; i < frames && !inst->gb.cpu.ill; i++) {
+        gb_run_frame(&inst->gb);
+        gb_end_frame(&inst->gb);
+        inst->frame++;
+    }
+}
+
+struct pool_job {
+    void (*fn)(void*);
+    void* arg;
+    struct pool_job* next;
+};
+
+struct gb_pool {
+    pthread_t* threads;
+    int n_threads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t job_ready;
+    pthread_cond_t all_done;
+
+    struct pool_job* head;
+    struct pool_job* tail;
+    int pending;
+    bool quit;
+};
+
+static void* pool_worker(void* arg) {
+    struct gb_pool* pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (!pool->head && !pool->quit) {
+            pthread_cond_wait(&pool->job_ready, &pool->lock);
+        }
+        if (!pool->head) break;
+        struct pool_job* job = pool->head;
+        pool->head = job->next;
+        if (!pool->head) pool->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        job->fn(job->arg);
+        free(job);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) pthread_cond_broadcast(&pool->all_done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+struct gb_pool* pool_create(int n_threads) {
+    if (n_threads < 1) n_threads = 1;
+    struct gb_pool* pool = calloc(1, sizeof *pool);
+    if (!pool) return NULL;
+    pool->threads = calloc(n_threads, sizeof *pool->threads);
+    if (!pool->threads) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->job_ready, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+    for (int i = 0; i < n_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, pool_worker, pool)) break;
+        pool->n_threads++;
+    }
+    if (!pool->n_threads) {
+        pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void pool_destroy(struct gb_pool* pool) {
+    if (!pool) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->job_ready);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->n_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->job_ready);
+    pthread_cond_destroy(&pool->all_done);
+    free(pool->threads);
+    free(pool);
+}
+
+// false if the job could not be queued, in which case it is not run
+bool pool_submit(struct gb_pool* pool, void (*fn)(void*), void* arg) {
+    struct pool_job* job = malloc(sizeof *job);
+    if (!job) return false;
+    job->fn = fn;
+    job->arg = arg;
+    job->next = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail) pool->tail->next = job;
+    else pool->head = job;
+    pool->tail = job;
+    pool->pending++;
+    pthread_cond_signal(&pool->job_ready);
+    pthread_mutex_unlock(&pool->lock);
+    return true;
+}
+
+void pool_wait(struct gb_pool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending) pthread_cond_wait(&pool->all_done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+struct create_job {
+    char* rom_filename;
+    struct gb_config* cfg;
+    struct gb_instance** inst;
+};
+
+static void create_job(void* arg) {
+    struct create_job* job = arg;
+    *job->inst = instance_create(job->rom_filename, job->cfg);
+}
+
+// false if any instance could not be created. those are left NULL
+bool pool_create_instances(struct gb_pool* pool, char** rom_filenames, int n,
+                           struct gb_config* cfg, struct gb_instance** insts) {
+    for (int i = 0; i < n; i++) insts[i] = NULL;
+    struct create_job* jobs = malloc(n * sizeof *jobs);
+    if (!jobs) return false;
+    for (int i = 0; i < n; i++) {
+        jobs[i].rom_filename = rom_filenames[i];
+        jobs[i].cfg = cfg;
+        jobs[i].inst = &insts[i];
+        if (!pool_submit(pool, create_job, &jobs[i])) break;
+    }
+    pool_wait(pool);
+    free(jobs);
+    for (int i = 0; i < n; i++) {
+        if (!insts[i]) return false;
+    }
+    return true;
+}
+
+static void run_job(void* arg) {
+    struct gb_instance* inst = arg;
+    instance_run_frames(inst, inst->frames_pending);
+    inst->frames_pending = 0;
+}
+
+void pool_run_frames(struct gb_pool* pool, struct gb_instance** insts, int n,
+                     unsigned long frames) {
+    for (int i = 0; i < n; i++) {
+        if (!insts[i]) continue;
+        insts[i]->frames_pending = frames;
+        // run here when there is no memory to queue it
+        if (!pool_submit(pool, run_job, insts[i])) run_job(insts[i]);
+    }
+    pool_wait(pool);
+}
+
+static void destroy_job(void* arg) {
+    instance_destroy(arg);
+}
+
+void pool_destroy_instances(struct gb_pool* pool, struct gb_instance** insts,
+                            int n) {
+    for (int i = 0; i < n; i++) {
+        if (!insts[i]) continue;
+        if (!pool_submit(pool, destroy_job, insts[i])) destroy_job(insts[i]);
+        insts[i] = NULL;
+    }
+    pool_wait(pool);
+}
\ No newline at end of file
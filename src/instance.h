@@ -0,0 +1,41 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "cartridge.h"
+#include "gb.h"
+#include "types.h"
+
+/*
+an instance is a gb together with its own cartridge. instances share no
+state, so any number of them can be stepped at once from different threads.
+note that two instances of the same battery backed rom still write back to
+the same save file, and the last write wins.
+*/
+struct gb_instance {
+    struct gb gb;
+    struct cartridge* cart;
+
+    unsigned long frame;
+    unsigned long frames_pending;
+};
+
+struct gb_pool;
+
+struct gb_instance* instance_create(char* rom_filename, struct gb_config* cfg);
+void instance_destroy(struct gb_instance* inst);
+void instance_run_frames(struct gb_instance* inst, unsigned long frames);
+
+struct gb_pool* pool_create(int n_threads);
+void pool_destroy(struct gb_pool* pool);
+
+bool pool_submit(struct gb_pool* pool, void (*fn)(void*), void* arg);
+void pool_wait(struct gb_pool* pool);
+
+bool pool_create_instances(struct gb_pool* pool, char** rom_filenames, int n,
+                           struct gb_config* cfg, struct gb_instance** insts);
+void pool_run_frames(struct gb_pool* pool, struct gb_instance** insts, int n,
+                     unsigned long frames);
+void pool_destroy_instances(struct gb_pool* pool, struct gb_instance** insts,
+                            int n);
+
+#endif
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <SDL2/SDL.h>
 
@@ -27,41 +29,129 @@ void center_screen_in_window(SDL_Rect* dst) {
 }
 
 int main(int argc, char** argv) {
-    if (argc < 2) {
-        printf("pass rom file name as argument\n");
+    int audio_latency_ms = AUDIO_LATENCY_MS;
+    enum pace_mode pace_mode = PACE_VIDEO;
+    int rewind_interval = REWIND_INTERVAL;
+    int rewind_mb = REWIND_MB;
+    int flush_ms = BATTERY_FLUSH_MS;
+    enum rtc_mode rtc_mode = RTC_SYNC;
+    char* movie_filename = NULL;
+    bool record = false;
+    bool from_state = false;
+    bool bad_args = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:p:i:b:w:c:m:M:s")) != -1) {
+        switch (opt) {
+            case 'l':
+                audio_latency_ms = atoi(optarg);
+                break;
+            case 'p':
+                if (!strcmp(optarg, "video")) {
+                    pace_mode = PACE_VIDEO;
+                } else if (!strcmp(optarg, "audio")) {
+                    pace_mode = PACE_AUDIO;
+                } else if (!strcmp(optarg, "none")) {
+                    pace_mode = PACE_NONE;
+                } else {
+                    bad_args = true;
+                }
+                break;
+            case 'i':
+                rewind_interval = atoi(optarg);
+                break;
+            case 'b':
+                rewind_mb = atoi(optarg);
+                break;
+            case 'w':
+                flush_ms = atoi(optarg);
+                break;
+            case 'c':
+                if (!strcmp(optarg, "sync")) {
+                    rtc_mode = RTC_SYNC;
+                } else if (!strcmp(optarg, "cycles")) {
+                    rtc_mode = RTC_CYCLES;
+                } else if (!strcmp(optarg, "host")) {
+                    rtc_mode = RTC_HOST;
+                } else {
+                    bad_args = true;
+                }
+                break;
+            case 'm':
+            case 'M':
+                movie_filename = optarg;
+                record = opt == 'M';
+                break;
+            case 's':
+                from_state = true;
+                break;
+            default:
+                bad_args = true;
+                break;
+        }
+    }
+    if (bad_args || optind >= argc || audio_latency_ms < 1 ||
+        rewind_interval < 1 || rewind_mb < 0 || flush_ms < 0 ||
+        (from_state && !record)) {
+        printf("usage: %s [-l audio latency ms] [-p video|audio|none] "
+               "[-i rewind interval frames] [-b rewind buffer mb] "
+               "[-w save write back interval ms] [-c sync|cycles|host] "
+               "[-m movie | -M movie [-s]] rom\n",
+               argv[0]);
         return -1;
     }
 
-    if (!emulator_init()) {
+    if (!emulator_init(audio_latency_ms, pace_mode, rewind_interval,
+                       rewind_mb)) {
         SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "gbemu",
                                  "Initialization Error.", NULL);
         return -1;
     }
 
-    if (!emu_load_rom(argv[1])) {
+    if (!emu_load_rom(argv[optind])) {
+        return -1;
+    }
+    if (gbemu.cart->battery) battery_set_interval(&gbemu.cart->sav, flush_ms);
+    cart_set_rtc_mode(gbemu.cart, rtc_mode);
+    if (movie_filename &&
+        !emu_start_movie(movie_filename, record, from_state)) {
+        return -1;
+    }
+
+    // emulation runs on its own thread from here on, and this one only
+    // handles input and shows whatever frame is newest
+    if (!emu_start_thread()) {
+        SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "gbemu",
+                                 "Initialization Error.", NULL);
         return -1;
     }
 
     bool running = true;
     while (running) {
-        if (gbemu.gb->cpu.ill) {
+        SDL_LockMutex(gbemu.lock);
+        bool ill = gbemu.gb->cpu.ill;
+        SDL_UnlockMutex(gbemu.lock);
+        if (ill) {
             SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "gbemu",
                                      "Illegal Opcode reached. Terminating.",
                                      gbemu.main_window);
             break;
         }
+        emu_report_save();
 
+        bool redraw = false;
         SDL_Event e;
         while (SDL_PollEvent(&e)) {
             if (e.type == SDL_QUIT) running = false;
             emu_handle_event(e);
+            redraw = true;
         }
-
-        if (!gbemu.paused) {
-            for (int i = 0; i < gbemu.speed - 1; i++) {
-                emu_run_frame(false, !gbemu.muted);
-            }
-            emu_run_frame(true, !gbemu.muted);
+        if (emu_take_frame()) {
+            update_texture();
+            redraw = true;
+        }
+        if (!redraw) {
+            SDL_Delay(1);
+            continue;
         }
 
         SDL_RenderClear(gbemu.main_renderer);
@@ -69,13 +159,6 @@ int main(int argc, char** argv) {
         center_screen_in_window(&dst);
         SDL_RenderCopy(gbemu.main_renderer, gbemu.gb_screen, NULL, &dst);
         SDL_RenderPresent(gbemu.main_renderer);
-
-        if (!gbemu.paused && !gbemu.muted && gbemu.gb->io[NR52]) {
-            while (SDL_GetQueuedAudioSize(gbemu.gb_audio) > 8 * SAMPLE_BUF_LEN)
-                SDL_Delay(1);
-        } else {
-            SDL_Delay(10);
-        }
     }
 
     emulator_quit();
@@ -0,0 +1,133 @@
+#include "movie.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "state.h"
+
+// starts from the gb as it is now. flags are MOVIE_ flags describing that
+bool movie_record(struct movie* mv, struct gb* gb, char* filename, u32 flags) {
+    memset(mv, 0, sizeof *mv);
+    size_t size = state_max_size(gb, STATE_COMPRESS);
+    u8* state = malloc(size);
+    if (!state) return false;
+    size = save_state_to_buffer(gb, state, size, STATE_COMPRESS);
+
+    struct movie_header hdr = {.magic = "GBMV",
+                               .version = MOVIE_VERSION,
+                               .flags = flags,
+                               .rom_crc = gb->cart->rom_crc,
+                               .state_size = size};
+    FILE* file = size ? fopen(filename, "wb") : NULL;
+    bool ok = file && fwrite(&hdr, sizeof hdr, 1, file) == 1 &&
+              fwrite(state, 1, size, file) == size;
+    free(state);
+    if (!ok) {
+        if (file) fclose(file);
+        return false;
+    }
+
+    mv->gb = gb;
+    mv->mode = MOVIE_RECORDING;
+    mv->flags = flags;
+    mv->file = file;
+    return true;
+}
+
+// loads the state the movie starts from into gb. false if the movie is not
+// for the rom gb is running, in which case the gb is left alone
+bool movie_play(struct movie* mv, struct gb* gb, char* filename) {
+    memset(mv, 0, sizeof *mv);
+    FILE* file = fopen(filename, "rb");
+    if (!file) return false;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    u8* data = malloc(size > 0 ? size : 1);
+    bool ok = data && size > 0 && fread(data, 1, size, file) == size;
+    fclose(file);
+
+    struct movie_header hdr;
+    if (ok && size >= sizeof hdr) memcpy(&hdr, data, sizeof hdr);
+    if (!ok || size < sizeof hdr || memcmp(hdr.magic, "GBMV", 4) ||
+        hdr.version != MOVIE_VERSION || hdr.rom_crc != gb->cart->rom_crc ||
+        hdr.state_size > size - sizeof hdr ||
+        !load_state_from_buffer(gb, data + sizeof hdr, hdr.state_size)) {
+        free(data);
+        return false;
+    }
+
+    mv->gb = gb;
+    mv->mode = MOVIE_PLAYING;
+    mv->flags = hdr.flags;
+    mv->data = data;
+    mv->frames = data + sizeof hdr + hdr.state_size;
+    mv->n_frames = (size - sizeof hdr - hdr.state_size) / MOVIE_FRAME_SIZE;
+    for (unsigned long i = 0; i < mv->n_frames; i++) {
+        if (!mv->frames[i * MOVIE_FRAME_SIZE + 1]) {
+            movie_close(mv);
+            return false;
+        }
+    }
+    return true;
+}
+
+// false if a recording could not be written out in full
+bool movie_close(struct movie* mv) {
+    bool ok = true;
+    if (mv->file) ok = fclose(mv->file) == 0 && !mv->write_error;
+    free(mv->data);
+    memset(mv, 0, sizeof *mv);
+    return ok;
+}
+
+/*
+sets the joypad and speed from the movie when playing, or notes them down
+when recording. either way the joypad is looked at again now, since the
+frontend may have done that for events of its own in between and the
+scheduled event is part of the state
+*/
+void movie_start_frame(struct movie* mv) {
+    struct gb* gb = mv->gb;
+    if (mv->mode == MOVIE_PLAYING) {
+        if (mv->frame >= mv->n_frames) return;
+        u8* rec = mv->frames + mv->frame * MOVIE_FRAME_SIZE;
+        gb->jp_dir = rec[0] & 0x0f;
+        gb->jp_action = rec[0] >> 4;
+        if (gb->cfg.speed != rec[1]) {
+            // the apu has to catch up at the old speed
+            apu_sync(&gb->apu, gb->sched.now);
+            gb->cfg.speed = rec[1];
+        }
+    } else if (mv->mode == MOVIE_RECORDING) {
+        mv->input = (gb->jp_dir & 0x0f) | (gb->jp_action & 0x0f) << 4;
+        mv->speed = gb->cfg.speed;
+    } else {
+        return;
+    }
+    gb_update_input(gb);
+}
+
+// checks the frame against the movie when playing. MOVIE_END follows the
+// last frame of a movie being played
+enum movie_status movie_end_frame(struct movie* mv) {
+    if (mv->mode == MOVIE_OFF) return MOVIE_OK;
+    if (mv->mode == MOVIE_PLAYING && mv->frame >= mv->n_frames) {
+        return MOVIE_END;
+    }
+    u32 hash = state_hash(mv->gb);
+    if (mv->mode == MOVIE_RECORDING) {
+        u8 rec[MOVIE_FRAME_SIZE] = {mv->input, mv->speed};
+        memcpy(rec + 2, &hash, 4);
+        if (fwrite(rec, 1, sizeof rec, mv->file) != sizeof rec) {
+            mv->write_error = true;
+        }
+        mv->frame++;
+        return MOVIE_OK;
+    }
+    u32 expected;
+    memcpy(&expected, mv->frames + mv->frame * MOVIE_FRAME_SIZE + 2, 4);
+    if (hash != expected) return MOVIE_DESYNC;
+    mv->frame++;
+    return mv->frame == mv->n_frames ? MOVIE_END : MOVIE_OK;
+}
\ No newline at end of file
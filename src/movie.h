@@ -0,0 +1,72 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdio.h>
+
+#include "gb.h"
+#include "types.h"
+
+#define MOVIE_VERSION 1
+
+// bytes per frame: the joypad, the speed and the state hash
+#define MOVIE_FRAME_SIZE 6
+
+// the state was taken right after a reset
+enum { MOVIE_POWER_ON = 1 << 0 };
+
+enum movie_mode { MOVIE_OFF, MOVIE_RECORDING, MOVIE_PLAYING };
+
+// how a frame of a movie went
+enum movie_status { MOVIE_OK, MOVIE_END, MOVIE_DESYNC };
+
+/*
+movie format, in host byte order:
+header: "GBMV", version, flags, rom crc32, size of the save state that
+follows
+state: deflated save state the movie starts from
+frames: to the end of the file, the joypad as jp_dir | jp_action << 4 and
+cfg.speed for the frame, which the apu is clocked by, then the state_hash of
+the gb after it. a recording that was cut short still plays up to its last
+whole frame
+*/
+struct movie_header {
+    char magic[4];
+    u32 version;
+    u32 flags;
+    u32 rom_crc;
+    u32 state_size;
+};
+
+/*
+a movie is recorded or played back a frame at a time, with
+movie_start_frame before each frame and movie_end_frame after it. input and
+hashes are only applied and taken there, so both have to run under whatever
+lock keeps other threads off the gb while it is between frames
+*/
+struct movie {
+    struct gb* gb;
+    enum movie_mode mode;
+    u32 flags;
+
+    // recording. frames are appended as they finish
+    FILE* file;
+    u8 input;
+    u8 speed;
+    bool write_error;
+
+    // playing. the whole file, and the frames in it
+    u8* data;
+    u8* frames;
+    unsigned long n_frames;
+
+    // frames recorded or played so far
+    unsigned long frame;
+};
+
+bool movie_record(struct movie* mv, struct gb* gb, char* filename, u32 flags);
+bool movie_play(struct movie* mv, struct gb* gb, char* filename);
+bool movie_close(struct movie* mv);
+void movie_start_frame(struct movie* mv);
+enum movie_status movie_end_frame(struct movie* mv);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,55 @@
+#include "pace.h"
+
+#include <time.h>
+
+#include "ppu.h"
+
+#define NS_PER_SEC 1000000000ull
+
+// the last stretch before a deadline is spun instead of slept, since sleeps
+// can overshoot by about this much
+#define SPIN_NS 1000000ull
+// falling this far behind resets the pacer instead of rushing to catch up
+#define MAX_LAG_NS 100000000ull
+
+u64 pace_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+// plain sleep, for waits that do not need to be exact
+void pace_sleep(u64 ns) {
+    struct timespec ts = {.tv_sec = ns / NS_PER_SEC,
+                          .tv_nsec = ns % NS_PER_SEC};
+    nanosleep(&ts, NULL);
+}
+
+void pace_sleep_until(u64 deadline) {
+    u64 now = pace_now();
+    while (now + SPIN_NS < deadline) {
+        pace_sleep(deadline - now - SPIN_NS);
+        now = pace_now();
+    }
+    while (pace_now() < deadline) {
+    }
+}
+
+void pace_reset(struct pacer* p) {
+    p->origin = pace_now();
+    p->cycles = 0;
+}
+
+void pace_frame(struct pacer* p, u64 cycles) {
+    p->cycles += cycles;
+    // whole seconds move into the origin so the conversion stays exact
+    p->origin += p->cycles / GB_CLOCK_FREQ * NS_PER_SEC;
+    p->cycles %= GB_CLOCK_FREQ;
+    u64 deadline = p->origin + p->cycles * NS_PER_SEC / GB_CLOCK_FREQ;
+
+    if (pace_now() > deadline + MAX_LAG_NS) {
+        pace_reset(p);
+        return;
+    }
+    pace_sleep_until(deadline);
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+#ifndef PACE_H
+#define PACE_H
+
+#include "types.h"
+
+/*
+frame pacing against the host's monotonic clock. each frame adds the cycles it
+emulated and the pacer sleeps until the host clock catches up with them, so
+error never accumulates no matter how long individual frames take.
+- video: frames follow the emulated clock, and audio is resampled to keep up
+- audio: frames follow the audio device as it drains the sample ring
+- none: run as fast as possible
+*/
+enum pace_mode { PACE_VIDEO, PACE_AUDIO, PACE_NONE };
+
+struct pacer {
+    // host time that cycles are counted from, in ns
+    u64 origin;
+    u64 cycles;
+};
+
+u64 pace_now();
+void pace_sleep(u64 ns);
+void pace_sleep_until(u64 deadline);
+void pace_reset(struct pacer* p);
+void pace_frame(struct pacer* p, u64 cycles);
+
+#endif
\ No newline at end of file
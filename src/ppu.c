@@ -1,15 +1,44 @@
 #include "ppu.h"
 
-#include <SDL2/SDL.h>
+#include <string.h>
 
-#include "emulator.h"
 #include "gb.h"
 
-static u8 reverse_byte(u8 b) {
-    b = (b & 0xf0) >> 4 | (b & 0x0f) << 4;
-    b = (b & 0xcc) >> 2 | (b & 0x33) << 2;
-    b = (b & 0xaa) >> 1 | (b & 0x55) << 1;
-    return b;
+// marks the tile behind a vram address for decoding again. has to be called
+// on every write to tile data
+void ppu_vram_written(struct gb_ppu* ppu, int bank, u16 addr) {
+    addr &= 0x1fff;
+    if (addr >= TILE_COUNT * 16) return;
+    ppu->tile_dirty[bank][addr >> 10] |= 1ull << ((addr >> 4) & 63);
+}
+
+// for when vram changed without going through writes
+void ppu_invalidate_tiles(struct gb_ppu* ppu) {
+    memset(ppu->tile_dirty, 0xff, sizeof ppu->tile_dirty);
+}
+
+static void decode_tile(struct gb_ppu* ppu, int bank, int tile) {
+    u8* data = ppu->master->vram[bank] + 16 * tile;
+    for (int row = 0; row < 8; row++) {
+        u8 b0 = data[2 * row];
+        u8 b1 = data[2 * row + 1];
+        for (int x = 0; x < 8; x++) {
+            u8 index = ((b0 >> (7 - x)) & 1) | ((b1 >> (7 - x)) & 1) << 1;
+            ppu->tile_rows[bank][tile][0][row][x] = index;
+            ppu->tile_rows[bank][tile][1][row][7 - x] = index;
+        }
+    }
+}
+
+// the 8 pixel indices of a row of a tile, left to right or x flipped
+const u8* ppu_tile_row(struct gb_ppu* ppu, int bank, int tile, int row,
+                       bool xflip) {
+    u64 bit = 1ull << (tile & 63);
+    if (ppu->tile_dirty[bank][tile >> 6] & bit) {
+        decode_tile(ppu, bank, tile);
+        ppu->tile_dirty[bank][tile >> 6] &= ~bit;
+    }
+    return ppu->tile_rows[bank][tile][xflip][row];
 }
 
 static void load_bg_tile(struct gb_ppu* ppu) {
@@ -30,45 +59,49 @@ static void load_bg_tile(struct gb_ppu* ppu) {
     }
     u8 tile_index = ppu->master->vram[0][tilemap_start + tilemap_offset];
     u8 tile_attr = ppu->master->vram[1][tilemap_start + tilemap_offset];
-    u16 tile_addr;
+    int tile;
     if (ppu->master->io[LCDC] & LCDC_BG_TILE_AREA) {
-        tile_addr = tile_index << 4;
+        tile = tile_index;
     } else {
-        tile_addr = 0x1000 + ((s8) tile_index << 4);
+        tile = 0x100 + (s8) tile_index;
     }
     u8 bank = (tile_attr & BG_BANK) ? 1 : 0;
     u8 off_y = ppu->fineY;
     if (tile_attr & BG_YFLIP) off_y = 7 - off_y;
-    ppu->bg_tile_b0 = ppu->master->vram[bank][tile_addr + 2 * off_y];
-    ppu->bg_tile_b1 = ppu->master->vram[bank][tile_addr + 2 * off_y + 1];
-    if (tile_attr & BG_XFLIP) {
-        ppu->bg_tile_b0 = reverse_byte(ppu->bg_tile_b0);
-        ppu->bg_tile_b1 = reverse_byte(ppu->bg_tile_b1);
-    }
+    memcpy(ppu->bg_row,
+           ppu_tile_row(ppu, bank, tile, off_y, tile_attr & BG_XFLIP),
+           sizeof ppu->bg_row);
     if (tile_attr & BG_BGOVER) ppu->bg_tile_bgover = ~0;
     if ((tile_attr & BG_CPAL) & 0b001) ppu->bg_tile_cpal_b0 = ~0;
     if ((tile_attr & BG_CPAL) & 0b010) ppu->bg_tile_cpal_b1 = ~0;
     if ((tile_attr & BG_CPAL) & 0b100) ppu->bg_tile_cpal_b2 = ~0;
 }
 
+// the pixel indices of an object's tile on the current line
+static const u8* fetch_obj_row(struct gb_ppu* ppu, u8 obj) {
+    int rel_y = ppu->scanline - ppu->master->oam[obj] + 16;
+    u8 tile_index = ppu->master->oam[obj + 2];
+    u8 obj_attr = ppu->master->oam[obj + 3];
+    if (ppu->master->io[LCDC] & LCDC_OBJ_SIZE) {
+        if (obj_attr & OBJ_YFLIP) rel_y = 15 - rel_y;
+        tile_index &= ~1;
+    } else {
+        if (obj_attr & OBJ_YFLIP) rel_y = 7 - rel_y;
+    }
+    u8 bank = (obj_attr & OBJ_BANK) ? 1 : 0;
+    return ppu_tile_row(ppu, bank, tile_index + (rel_y >> 3), rel_y & 7,
+                        obj_attr & OBJ_XFLIP);
+}
+
 static void load_obj_tile(struct gb_ppu* ppu) {
     for (int i = 0; i < ppu->obj_ct; i++) {
         if (ppu->screenX != ppu->master->oam[ppu->objs[i] + 1] - 8) continue;
-        int rel_y = ppu->scanline - ppu->master->oam[ppu->objs[i]] + 16;
-        u8 tile_index = ppu->master->oam[ppu->objs[i] + 2];
         u8 obj_attr = ppu->master->oam[ppu->objs[i] + 3];
-        if (ppu->master->io[LCDC] & LCDC_OBJ_SIZE) {
-            if (obj_attr & OBJ_YFLIP) rel_y = 15 - rel_y;
-            tile_index &= ~1;
-        } else {
-            if (obj_attr & OBJ_YFLIP) rel_y = 7 - rel_y;
-        }
-        u8 bank = (obj_attr & OBJ_BANK) ? 1 : 0;
-        u8 obj_b0 = ppu->master->vram[bank][(tile_index << 4) + 2 * rel_y];
-        u8 obj_b1 = ppu->master->vram[bank][(tile_index << 4) + 2 * rel_y + 1];
-        if (obj_attr & OBJ_XFLIP) {
-            obj_b0 = reverse_byte(obj_b0);
-            obj_b1 = reverse_byte(obj_b1);
+        const u8* row = fetch_obj_row(ppu, ppu->objs[i]);
+        u8 obj_b0 = 0, obj_b1 = 0;
+        for (int j = 0; j < 8; j++) {
+            obj_b0 |= (row[j] & 1) << (7 - j);
+            obj_b1 |= (row[j] >> 1) << (7 - j);
         }
 
         u8 mask = 0;
@@ -105,7 +138,7 @@ static void load_obj_tile(struct gb_ppu* ppu) {
     }
 }
 
-Uint32 convert_cgb_color(u16 cgb_color) {
+u32 convert_cgb_color(u16 cgb_color) {
     u8 r = (cgb_color >> 0) & 0x1f;
     r = (r << 3) | (r & 0b111);
     u8 g = (cgb_color >> 5) & 0x1f;
@@ -115,7 +148,213 @@ Uint32 convert_cgb_color(u16 cgb_color) {
     return (r << 16) | (g << 8) | (b << 0);
 }
 
-void ppu_clock(struct gb_ppu* ppu) {
+// recomputes the color at the given cram address of the bg or obj palettes
+void ppu_update_cgb_color(struct gb_ppu* ppu, bool obj, u8 addr) {
+    u8* cram = obj ? ppu->master->obj_cram : ppu->master->bg_cram;
+    u32(*colors)[4] = obj ? ppu->obj_colors : ppu->bg_colors;
+    addr &= ~1;
+    colors[addr >> 3][(addr >> 1) & 3] =
+        convert_cgb_color(cram[addr] | cram[addr + 1] << 8);
+}
+
+// recomputes BGP, OBP0 or OBP1 for i 0, 1 or 2
+void ppu_update_dmg_palette(struct gb_ppu* ppu, int i) {
+    u8 pal = ppu->master->io[BGP + i];
+    for (int j = 0; j < 4; j++) {
+        ppu->dmg_pal[i][j] = ppu->master->cfg.dmg_colors[(pal >> (2 * j)) & 3];
+    }
+}
+
+// for when the palettes changed without going through their registers
+void ppu_update_palettes(struct gb_ppu* ppu) {
+    for (int i = 0; i < CRAM_SIZE; i += 2) {
+        ppu_update_cgb_color(ppu, false, i);
+        ppu_update_cgb_color(ppu, true, i);
+    }
+    for (int i = 0; i < 3; i++) ppu_update_dmg_palette(ppu, i);
+}
+
+static void scan_oam(struct gb_ppu* ppu) {
+    if (!ppu->master->dma_active && !(ppu->cycle & 1) && ppu->obj_ct < 10) {
+        u8 obj_y = ppu->master->oam[2 * ppu->cycle];
+        int rel_y = ppu->scanline - obj_y + 16;
+        if (rel_y >= 0 &&
+            rel_y < ((ppu->master->io[LCDC] & LCDC_OBJ_SIZE) ? 16 : 8)) {
+            ppu->objs[ppu->obj_ct++] = 2 * ppu->cycle;
+        }
+    }
+}
+
+/*
+draws the rest of a line in one go, starting after the first dot of mode 3.
+the result is the same as running the dot path up to the end of mode 3, as
+long as nothing it reads changes in that time. the background is drawn a tile
+at a time straight from the shift registers, and objects are laid out in a
+line buffer beforehand instead of being shifted out pixel by pixel
+*/
+static void render_line(struct gb_ppu* ppu) {
+    struct gb* gb = ppu->master;
+    bool bg_on = gb->cgb_mode || (gb->io[LCDC] & LCDC_BG_ENABLE);
+    bool obj_on = !gb->dma_active && (gb->io[LCDC] & LCDC_OBJ_ENABLE);
+    int win_x = -8;
+    if (bg_on && (gb->io[LCDC] & LCDC_WINDOW_ENABLE) && ppu->rendering_window)
+        win_x = gb->io[WX] - 7;
+
+    // pixel x of the line is at x + 8, up to the 8 pixels after the line
+    u8 obj_index[GB_SCREEN_W + 16] = {0};
+    u8 obj_attr[GB_SCREEN_W + 16] = {0};
+    u8 obj_owner[GB_SCREEN_W + 16];
+    memset(obj_owner, 0xff, sizeof obj_owner);
+    for (int j = 0; j < 8; j++) {
+        u8 bit = 0x80 >> j;
+        int i = ppu->screenX + 8 + j;
+        if (ppu->obj_tile_b0 & bit) obj_index[i] |= 0b01;
+        if (ppu->obj_tile_b1 & bit) obj_index[i] |= 0b10;
+        if (ppu->obj_tile_pal & bit) obj_attr[i] |= OBJ_PAL;
+        if (ppu->obj_tile_bgover & bit) obj_attr[i] |= OBJ_BGOVER;
+        if (ppu->obj_tile_cpal_b0 & bit) obj_attr[i] |= 0b001;
+        if (ppu->obj_tile_cpal_b1 & bit) obj_attr[i] |= 0b010;
+        if (ppu->obj_tile_cpal_b2 & bit) obj_attr[i] |= 0b100;
+        obj_owner[i] = ppu->obj_oam_inds[(ppu->obj_oam_head + j) % 8];
+    }
+
+    if (obj_on) {
+        // objects are loaded in order of x, then oam index
+        u8 order[10];
+        int n = 0;
+        for (int i = 0; i < ppu->obj_ct; i++) {
+            u8 obj = ppu->objs[i];
+            int x = gb->oam[obj + 1] - 8;
+            if (x < ppu->screenX || x >= GB_SCREEN_W) continue;
+            int j = n++;
+            while (j > 0 && gb->oam[order[j - 1] + 1] > gb->oam[obj + 1]) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = obj;
+        }
+        for (int i = 0; i < n; i++) {
+            u8 obj = order[i];
+            int start = gb->oam[obj + 1];
+            u8 attr = gb->oam[obj + 3] & (OBJ_PAL | OBJ_BGOVER | OBJ_CPAL);
+            const u8* row = fetch_obj_row(ppu, obj);
+            for (int j = 0; j < 8; j++) {
+                u8 index = row[j];
+                int k = start + j;
+                if (index && (!obj_index[k] ||
+                              (gb->cgb_mode && obj_owner[k] > obj))) {
+                    obj_index[k] = index;
+                    obj_attr[k] = attr;
+                    obj_owner[k] = obj;
+                }
+            }
+        }
+    }
+
+    int x = ppu->screenX;
+    while (x < GB_SCREEN_W) {
+        ppu->screenX = x;
+        if (ppu->fineX == 0) load_bg_tile(ppu);
+        if (x == win_x) {
+            ppu->tileX = 0;
+            ppu->fineX = 0;
+            ppu->tileY = (ppu->windowline >> 3) & (TILEMAP_SIZE - 1);
+            ppu->fineY = ppu->windowline & 0b111;
+            ppu->windowline++;
+            load_bg_tile(ppu);
+        }
+        int end = x + 8 - ppu->fineX;
+        if (x < win_x && win_x < end) end = win_x;
+        if (end > GB_SCREEN_W) end = GB_SCREEN_W;
+
+        // pixel px of the segment is pixel px + row_off of the tile row
+        int row_off = ppu->fineX - x;
+        for (int px = x < 0 ? 0 : x; px < end; px++) {
+            u8 bit = 0x80 >> (px - x);
+            u8 bg_index = 0;
+            u32 color = 0x00ffffff;
+            if (bg_on) {
+                bg_index = ppu->bg_row[px + row_off];
+                if (gb->cgb_mode) {
+                    u8 pal = 0;
+                    if (ppu->bg_tile_cpal_b0 & bit) pal |= 0b001;
+                    if (ppu->bg_tile_cpal_b1 & bit) pal |= 0b010;
+                    if (ppu->bg_tile_cpal_b2 & bit) pal |= 0b100;
+                    color = ppu->bg_colors[pal][bg_index];
+                } else {
+                    color = ppu->dmg_pal[0][bg_index];
+                }
+            }
+            u8 obj = obj_index[px + 8];
+            u8 attr = obj_attr[px + 8];
+            if (obj_on && obj &&
+                (bg_index == 0 ||
+                 (gb->cgb_mode && !(gb->io[LCDC] & LCDC_BG_ENABLE)) ||
+                 !((ppu->bg_tile_bgover & bit) || (attr & OBJ_BGOVER)))) {
+                if (gb->cgb_mode) {
+                    color = ppu->obj_colors[attr & OBJ_CPAL][obj];
+                } else {
+                    color = ppu->dmg_pal[(attr & OBJ_PAL) ? 2 : 1][obj];
+                }
+            }
+            ppu->screen[ppu->scanline][px] = color;
+        }
+
+        int n = end - x;
+        ppu->bg_tile_bgover <<= n;
+        ppu->bg_tile_cpal_b0 <<= n;
+        ppu->bg_tile_cpal_b1 <<= n;
+        ppu->bg_tile_cpal_b2 <<= n;
+        ppu->fineX += n;
+        if (ppu->fineX == 8) {
+            ppu->tileX++;
+            ppu->fineX = 0;
+        }
+        ppu->obj_oam_head = (ppu->obj_oam_head + n) & 7;
+        x = end;
+    }
+    ppu->screenX = GB_SCREEN_W;
+
+    // leave the object registers as the dot path would
+    ppu->obj_tile_b0 = 0;
+    ppu->obj_tile_b1 = 0;
+    ppu->obj_tile_pal = 0;
+    ppu->obj_tile_bgover = 0;
+    ppu->obj_tile_cpal_b0 = 0;
+    ppu->obj_tile_cpal_b1 = 0;
+    ppu->obj_tile_cpal_b2 = 0;
+    for (int j = 0; j < 8; j++) {
+        u8 bit = 0x80 >> j;
+        int i = GB_SCREEN_W + 8 + j;
+        if (obj_index[i] & 0b01) ppu->obj_tile_b0 |= bit;
+        if (obj_index[i] & 0b10) ppu->obj_tile_b1 |= bit;
+        if (obj_attr[i] & OBJ_PAL) ppu->obj_tile_pal |= bit;
+        if (obj_attr[i] & OBJ_BGOVER) ppu->obj_tile_bgover |= bit;
+        if (obj_attr[i] & 0b001) ppu->obj_tile_cpal_b0 |= bit;
+        if (obj_attr[i] & 0b010) ppu->obj_tile_cpal_b1 |= bit;
+        if (obj_attr[i] & 0b100) ppu->obj_tile_cpal_b2 |= bit;
+        ppu->obj_oam_inds[(ppu->obj_oam_head + j) % 8] = obj_owner[i];
+    }
+}
+
+// moves mode 3 on by n pixels without fetching or drawing anything, keeping
+// what outlives the line: the mode and the window line counter
+static void skip_pixels(struct gb_ppu* ppu, int n) {
+    struct gb* gb = ppu->master;
+    if (ppu->screenX == -8) {
+        gb->io[STAT] &= ~STAT_MODE;
+        gb->io[STAT] |= 3;
+    }
+    int win_x = gb->io[WX] - 7;
+    if ((gb->cgb_mode || (gb->io[LCDC] & LCDC_BG_ENABLE)) &&
+        (gb->io[LCDC] & LCDC_WINDOW_ENABLE) && ppu->rendering_window &&
+        ppu->screenX <= win_x && win_x < ppu->screenX + n) {
+        ppu->windowline++;
+    }
+    ppu->screenX += n;
+}
+
+static void ppu_clock(struct gb_ppu* ppu) {
     if (!(ppu->master->io[LCDC] & LCDC_ENABLE)) {
         ppu->cycle = 0;
         ppu->scanline = 0;
@@ -140,18 +379,12 @@ void ppu_clock(struct gb_ppu* ppu) {
                 ppu->obj_ct = 0;
             }
 
-            if (!ppu->master->dma_active && !(ppu->cycle & 1) &&
-                ppu->obj_ct < 10) {
-                u8 obj_y = ppu->master->oam[2 * ppu->cycle];
-                int rel_y = ppu->scanline - obj_y + 16;
-                if (rel_y >= 0 &&
-                    rel_y <
-                        ((ppu->master->io[LCDC] & LCDC_OBJ_SIZE) ? 16 : 8)) {
-                    ppu->objs[ppu->obj_ct++] = 2 * ppu->cycle;
-                }
-            }
+            scan_oam(ppu);
         } else if (ppu->wait > 0) {
             ppu->wait--;
+        } else if (ppu->screenX < GB_SCREEN_W &&
+                   (ppu->master->cfg.render_skip & SKIP_VIDEO)) {
+            skip_pixels(ppu, 1);
         } else if (ppu->screenX < GB_SCREEN_W) {
             if (ppu->screenX == -8) {
                 ppu->master->io[STAT] &= ~STAT_MODE;
@@ -164,8 +397,6 @@ void ppu_clock(struct gb_ppu* ppu) {
                 ppu->fineX = ppu->master->io[SCX] & 0b111;
 
                 load_bg_tile(ppu);
-                ppu->bg_tile_b0 <<= ppu->fineX;
-                ppu->bg_tile_b1 <<= ppu->fineX;
 
                 ppu->obj_tile_b0 = 0;
                 ppu->obj_tile_b1 = 0;
@@ -181,7 +412,7 @@ void ppu_clock(struct gb_ppu* ppu) {
             }
 
             u8 bg_index = 0;
-            Uint32 color = 0x00ffffff;
+            u32 color = 0x00ffffff;
             if (ppu->master->cgb_mode ||
                 (ppu->master->io[LCDC] & LCDC_BG_ENABLE)) {
                 if ((ppu->master->io[LCDC] & LCDC_WINDOW_ENABLE) &&
@@ -195,22 +426,15 @@ void ppu_clock(struct gb_ppu* ppu) {
                     load_bg_tile(ppu);
                 }
 
-                if (ppu->bg_tile_b0 & 0x80) bg_index |= 0b01;
-                if (ppu->bg_tile_b1 & 0x80) bg_index |= 0b10;
+                bg_index = ppu->bg_row[ppu->fineX];
                 if (ppu->master->cgb_mode) {
                     u8 pal = 0;
                     if (ppu->bg_tile_cpal_b0 & 0x80) pal |= 0b001;
                     if (ppu->bg_tile_cpal_b1 & 0x80) pal |= 0b010;
                     if (ppu->bg_tile_cpal_b2 & 0x80) pal |= 0b100;
-                    u16 cgb_color = 0;
-                    cgb_color |= ppu->master->bg_cram[pal * 8 + bg_index * 2];
-                    cgb_color |=
-                        ppu->master->bg_cram[pal * 8 + bg_index * 2 + 1] << 8;
-                    color = convert_cgb_color(cgb_color);
+                    color = ppu->bg_colors[pal][bg_index];
                 } else {
-                    color = gbemu.dmg_colors[(ppu->master->io[BGP] >>
-                                              (2 * bg_index)) &
-                                             0b11];
+                    color = ppu->dmg_pal[0][bg_index];
                 }
             }
             if (!ppu->master->dma_active &&
@@ -231,23 +455,10 @@ void ppu_clock(struct gb_ppu* ppu) {
                         if (ppu->obj_tile_cpal_b0 & 0x80) pal |= 0b001;
                         if (ppu->obj_tile_cpal_b1 & 0x80) pal |= 0b010;
                         if (ppu->obj_tile_cpal_b2 & 0x80) pal |= 0b100;
-                        u16 cgb_color = 0;
-                        cgb_color |=
-                            ppu->master->obj_cram[pal * 8 + obj_index * 2];
-                        cgb_color |=
-                            ppu->master->obj_cram[pal * 8 + obj_index * 2 + 1]
-                            << 8;
-                        color = convert_cgb_color(cgb_color);
+                        color = ppu->obj_colors[pal][obj_index];
                     } else {
-                        if (ppu->obj_tile_pal & 0x80) {
-                            color = gbemu.dmg_colors[(ppu->master->io[OBP1] >>
-                                                      (2 * obj_index)) &
-                                                     0b11];
-                        } else {
-                            color = gbemu.dmg_colors[(ppu->master->io[OBP0] >>
-                                                      (2 * obj_index)) &
-                                                     0b11];
-                        }
+                        color = ppu->dmg_pal[(ppu->obj_tile_pal & 0x80) ? 2 : 1]
+                                            [obj_index];
                     }
                 }
             }
@@ -256,8 +467,6 @@ void ppu_clock(struct gb_ppu* ppu) {
                 ppu->screen[ppu->scanline][ppu->screenX] = color;
             }
 
-            ppu->bg_tile_b0 <<= 1;
-            ppu->bg_tile_b1 <<= 1;
             ppu->bg_tile_bgover <<= 1;
             ppu->bg_tile_cpal_b0 <<= 1;
             ppu->bg_tile_cpal_b1 <<= 1;
@@ -297,4 +506,111 @@ void ppu_clock(struct gb_ppu* ppu) {
         }
         ppu->master->io[LY] = ppu->scanline;
     }
+}
+
+// dots the ppu runs in the t-cycles (from, to]. in double speed mode it only
+// runs on odd t-cycles, the first and third of each m-cycle
+static u64 dots_between(struct gb_ppu* ppu, u64 from, u64 to) {
+    if (!(ppu->master->io[KEY1] & (1 << 7))) return to - from;
+    return (to + 1) / 2 - (from + 1) / 2;
+}
+
+// t-cycle of the nth dot after from
+static u64 dot_time(struct gb_ppu* ppu, u64 from, u64 n) {
+    if (!(ppu->master->io[KEY1] & (1 << 7))) return from + n;
+    return from + 2 * n - 1 + (from & 1);
+}
+
+// catches the ppu up to the given t-cycle. this has to happen before anything
+// it reads is changed or anything it writes is looked at
+void ppu_sync(struct gb_ppu* ppu, u64 time) {
+    if (time <= ppu->sync_time) return;
+    u64 dots = dots_between(ppu, ppu->sync_time, time);
+    ppu->sync_time = time;
+    while (dots > 0) {
+        if (!(ppu->master->io[LCDC] & LCDC_ENABLE)) {
+            // every dot with the lcd off does the same reset
+            ppu_clock(ppu);
+            return;
+        }
+        if (ppu->scanline < GB_SCREEN_H && ppu->cycle > MODE2_LEN &&
+            ppu->screenX == -7 && dots >= GB_SCREEN_W + 7) {
+            // nothing can be written until mode 3 is over
+            if (ppu->master->cfg.render_skip & SKIP_VIDEO) {
+                skip_pixels(ppu, GB_SCREEN_W + 7);
+            } else {
+                render_line(ppu);
+            }
+            ppu->cycle += GB_SCREEN_W + 7;
+            dots -= GB_SCREEN_W + 7;
+            continue;
+        }
+        if (ppu->scanline < GB_SCREEN_H && ppu->cycle > 0 &&
+            ppu->cycle < MODE2_LEN) {
+            // the rest of the oam scan only reads oam, and only for drawing
+            if (ppu->master->cfg.render_skip & SKIP_VIDEO) {
+                u64 skip = MODE2_LEN - ppu->cycle;
+                if (skip > dots) skip = dots;
+                ppu->cycle += skip;
+                dots -= skip;
+                continue;
+            }
+            while (dots > 0 && ppu->cycle < MODE2_LEN) {
+                scan_oam(ppu);
+                ppu->cycle++;
+                dots--;
+            }
+            continue;
+        }
+        bool idle = ppu->cycle < CYCLES_PER_SCANLINE - 1 &&
+                    (ppu->scanline < GB_SCREEN_H
+                         ? ppu->cycle >= MODE2_LEN &&
+                               ppu->screenX == GB_SCREEN_W
+                         : ppu->scanline > GB_SCREEN_H || ppu->cycle > 0);
+        ppu_clock(ppu);
+        dots--;
+        if (idle) {
+            // the rest of hblank or a vblank line repeats the same dot
+            u64 skip = CYCLES_PER_SCANLINE - 1 - ppu->cycle;
+            if (skip > dots) skip = dots;
+            ppu->cycle += skip;
+            dots -= skip;
+        }
+    }
+}
+
+// schedules the next dot that changes the mode or ly
+void ppu_schedule(struct gb_ppu* ppu) {
+    struct gb* gb = ppu->master;
+    int next;
+    if (!(gb->io[LCDC] & LCDC_ENABLE)) {
+        if (!ppu->cycle && !ppu->scanline && !gb->io[LY] &&
+            !(gb->io[STAT] & STAT_MODE)) {
+            sched_cancel(&gb->sched, EV_PPU);
+            return;
+        }
+        next = ppu->cycle;
+    } else if (ppu->scanline < GB_SCREEN_H) {
+        if (ppu->cycle == 0) next = 0;
+        else if (ppu->cycle < MODE2_LEN) next = MODE2_LEN + ppu->wait;
+        else if (ppu->wait > 0) next = ppu->cycle + ppu->wait;
+        else if (ppu->screenX < GB_SCREEN_W)
+            next = ppu->cycle + GB_SCREEN_W - ppu->screenX;
+        else next = CYCLES_PER_SCANLINE - 1;
+    } else if (ppu->scanline == GB_SCREEN_H && ppu->cycle == 0) {
+        next = 0;
+    } else {
+        next = CYCLES_PER_SCANLINE - 1;
+    }
+    sched_add(&gb->sched, EV_PPU,
+              dot_time(ppu, ppu->sync_time, next - ppu->cycle + 1));
+}
+
+void ppu_event(struct gb_ppu* ppu, u64 time) {
+    ppu_sync(ppu, time);
+    ppu_schedule(ppu);
+    // events fall on every mode change, so this is where vram gets locked
+    update_vram_map(ppu->master);
+    sched_add(&ppu->master->sched, EV_STAT, time + 1);
+    schedule_hdma(ppu->master, time);
 }
\ No newline at end of file
@@ -1,8 +1,6 @@
 #ifndef PPU_H
 #define PPU_H
 
-#include <SDL2/SDL.h>
-
 #include "types.h"
 
 #define GB_SCREEN_W 160
@@ -10,8 +8,13 @@
 #define CYCLES_PER_SCANLINE 456
 #define SCANLINES_PER_FRAME 154
 #define MODE2_LEN 80
+#define CYCLES_PER_FRAME (CYCLES_PER_SCANLINE * SCANLINES_PER_FRAME)
+// t-cycles per second in single speed mode
+#define GB_CLOCK_FREQ (1 << 22)
 
 #define TILEMAP_SIZE 32
+// tiles in each vram bank
+#define TILE_COUNT 384
 
 enum {
     LCDC_BG_ENABLE = 1 << 0,
@@ -55,10 +58,14 @@ struct gb;
 struct gb_ppu {
     struct gb* master;
 
-    Uint32 screen[GB_SCREEN_H][GB_SCREEN_W];
+    // the frame being drawn. reset points it at frame, and a frontend can
+    // point it at buffers of its own to swap finished frames out
+    u32 (*screen)[GB_SCREEN_W];
+    u32 frame[GB_SCREEN_H][GB_SCREEN_W];
 
-    u8 bg_tile_b0;
-    u8 bg_tile_b1;
+    // pixel indices of the current bg tile's row. the pixel being drawn is
+    // at fineX
+    u8 bg_row[8];
 
     u8 bg_tile_bgover;
 
@@ -89,13 +96,37 @@ struct gb_ppu {
     u8 objs[10];
     u8 obj_ct;
 
+    // host colors of every palette entry, updated by the palette register
+    // writes. dmg_pal holds BGP, OBP0 and OBP1 in that order
+    u32 bg_colors[8][4];
+    u32 obj_colors[8][4];
+    u32 dmg_pal[3][4];
+
+    // every row of every tile decoded to pixel indices, left to right and
+    // x flipped. a tile with its dirty bit set is decoded again on next use
+    u8 tile_rows[2][TILE_COUNT][2][8][8];
+    u64 tile_dirty[2][TILE_COUNT / 64];
+
     int wait;
 
     int cycle;
     int scanline;
     bool frame_complete;
+
+    u64 sync_time;
 };
 
-void ppu_clock(struct gb_ppu* ppu);
+void ppu_update_cgb_color(struct gb_ppu* ppu, bool obj, u8 addr);
+void ppu_update_dmg_palette(struct gb_ppu* ppu, int i);
+void ppu_update_palettes(struct gb_ppu* ppu);
+
+void ppu_vram_written(struct gb_ppu* ppu, int bank, u16 addr);
+void ppu_invalidate_tiles(struct gb_ppu* ppu);
+const u8* ppu_tile_row(struct gb_ppu* ppu, int bank, int tile, int row,
+                       bool xflip);
+
+void ppu_sync(struct gb_ppu* ppu, u64 time);
+void ppu_schedule(struct gb_ppu* ppu);
+void ppu_event(struct gb_ppu* ppu, u64 time);
 
 #endif
\ No newline at end of file
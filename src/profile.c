@@ -0,0 +1,37 @@
+#include "profile.h"
+
+#ifdef GB_PROFILE
+
+#include <string.h>
+#include <sys/time.h>
+
+volatile sig_atomic_t prof_section;
+volatile unsigned long prof_samples[PROF_MAX];
+const char* prof_names[PROF_MAX] = {"cpu", "ppu", "apu", "dma", "other"};
+
+static void prof_handler(int sig) {
+    prof_samples[prof_section]++;
+}
+
+void prof_start(int interval_us) {
+    for (int i = 0; i < PROF_MAX; i++) prof_samples[i] = 0;
+    prof_section = PROF_CPU;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = prof_handler;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGPROF, &sa, NULL);
+
+    struct itimerval timer = {.it_interval = {0, interval_us},
+                              .it_value = {0, interval_us}};
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+void prof_stop() {
+    struct itimerval timer = {0};
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_DFL);
+}
+
+#endif
\ No newline at end of file
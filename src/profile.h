@@ -0,0 +1,26 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+enum { PROF_CPU, PROF_PPU, PROF_APU, PROF_DMA, PROF_OTHER, PROF_MAX };
+
+#ifdef GB_PROFILE
+
+#include <signal.h>
+
+// the core marks which subsystem it is in and a profiling timer samples it
+extern volatile sig_atomic_t prof_section;
+extern volatile unsigned long prof_samples[PROF_MAX];
+extern const char* prof_names[PROF_MAX];
+
+#define PROF_SECTION(s) (prof_section = (s))
+
+void prof_start(int interval_us);
+void prof_stop();
+
+#else
+
+#define PROF_SECTION(s)
+
+#endif
+
+#endif
\ No newline at end of file
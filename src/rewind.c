@@ -0,0 +1,167 @@
+#include "rewind.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "state.h"
+
+/*
+the xor of state and base as a run of zero words and a run of literal words,
+the two counts packed into one word ahead of the literals, repeated. base is
+null for a keyframe. out has room for words + 1 words, which is the worst case
+*/
+static size_t encode(const u64* state, const u64* base, size_t words,
+                     u64* out) {
+    size_t n = 0;
+    size_t i = 0;
+    while (i < words) {
+        size_t zeros = i;
+        while (i < words && state[i] == (base ? base[i] : 0)) i++;
+        zeros = i - zeros;
+        size_t header = n++;
+        size_t lits = i;
+        while (i < words && state[i] != (base ? base[i] : 0)) {
+            out[n++] = state[i] ^ (base ? base[i] : 0);
+            i++;
+        }
+        lits = i - lits;
+        out[header] = (u64) zeros << 32 | lits;
+    }
+    return n;
+}
+
+// xors a delta into state
+static void decode(u64* state, const u64* in, size_t size) {
+    size_t n = 0;
+    size_t i = 0;
+    while (n < size) {
+        u64 header = in[n++];
+        i += header >> 32;
+        for (u32 lits = header; lits; lits--) state[i++] ^= in[n++];
+    }
+}
+
+bool rewind_init(struct rewind* rw, struct gb* gb, int interval,
+                 size_t max_bytes) {
+    memset(rw, 0, sizeof *rw);
+    rw->gb = gb;
+    rw->interval = interval < 1 ? 1 : interval;
+    rw->max_bytes = max_bytes;
+    rw->size = state_max_size(gb, 0);
+    rw->words = (rw->size + 7) / 8;
+    // zeroed so the padding at the end never differs
+    rw->cur = calloc(rw->words, 8);
+    rw->key = calloc(rw->words, 8);
+    rw->scratch = malloc((rw->words + 1) * 8);
+    if (!rw->cur || !rw->key || !rw->scratch) {
+        rewind_free(rw);
+        return false;
+    }
+    return true;
+}
+
+void rewind_free(struct rewind* rw) {
+    rewind_clear(rw);
+    free(rw->entries);
+    free(rw->cur);
+    free(rw->key);
+    free(rw->scratch);
+    memset(rw, 0, sizeof *rw);
+}
+
+void rewind_clear(struct rewind* rw) {
+    for (int i = 0; i < rw->count; i++) {
+        free(rw->entries[(rw->first + i) % rw->cap].data);
+    }
+    rw->first = 0;
+    rw->count = 0;
+    rw->bytes = 0;
+    rw->key_valid = false;
+    rw->countdown = 0;
+}
+
+static struct rewind_entry* entry(struct rewind* rw, int i) {
+    return &rw->entries[(rw->first + i) % rw->cap];
+}
+
+// a delta is useless without its keyframe, so the oldest keyframe goes along
+// with all of its deltas
+static void drop_oldest(struct rewind* rw) {
+    do {
+        struct rewind_entry* e = entry(rw, 0);
+        rw->bytes -= e->size * 8;
+        free(e->data);
+        rw->first = (rw->first + 1) % rw->cap;
+        rw->count--;
+    } while (rw->count && !entry(rw, 0)->key);
+    if (!rw->count) rw->key_valid = false;
+}
+
+static bool push(struct rewind* rw, u64* data, size_t size, bool key) {
+    if (rw->count == rw->cap) {
+        int cap = rw->cap ? 2 * rw->cap : 64;
+        struct rewind_entry* entries = malloc(cap * sizeof *entries);
+        if (!entries) return false;
+        for (int i = 0; i < rw->count; i++) entries[i] = *entry(rw, i);
+        free(rw->entries);
+        rw->entries = entries;
+        rw->cap = cap;
+        rw->first = 0;
+    }
+    *entry(rw, rw->count++) = (struct rewind_entry){data, size, key};
+    rw->bytes += size * 8;
+    while (rw->count && rw->bytes > rw->max_bytes) drop_oldest(rw);
+    return true;
+}
+
+// call before running each frame
+void rewind_frame(struct rewind* rw) {
+    if (rw->countdown-- > 0) return;
+    rw->countdown = rw->interval - 1;
+
+    if (!save_state_to_buffer(rw->gb, (u8*) rw->cur, rw->size, 0)) return;
+    bool key = !rw->key_valid || rw->since_key >= REWIND_KEY_INTERVAL;
+    size_t size = encode(rw->cur, key ? NULL : rw->key, rw->words, rw->scratch);
+    u64* data = malloc(size * 8);
+    if (!data) return;
+    memcpy(data, rw->scratch, size * 8);
+    if (!push(rw, data, size, key)) {
+        free(data);
+        return;
+    }
+    if (key) {
+        memcpy(rw->key, rw->cur, rw->words * 8);
+        rw->key_valid = true;
+        rw->since_key = 0;
+    }
+    rw->since_key++;
+}
+
+// goes back to the newest snapshot and drops it. false if there are none left
+bool rewind_step(struct rewind* rw) {
+    if (!rw->count) return false;
+    struct rewind_entry* e = entry(rw, rw->count - 1);
+    if (e->key) {
+        memset(rw->cur, 0, rw->words * 8);
+        decode(rw->cur, e->data, e->size);
+        // the deltas before this one belong to an older keyframe
+        rw->key_valid = false;
+    } else {
+        if (!rw->key_valid) {
+            int k = rw->count - 1;
+            while (!entry(rw, k)->key) k--;
+            memset(rw->key, 0, rw->words * 8);
+            decode(rw->key, entry(rw, k)->data, entry(rw, k)->size);
+            rw->key_valid = true;
+        }
+        memcpy(rw->cur, rw->key, rw->words * 8);
+        decode(rw->cur, e->data, e->size);
+    }
+    rw->bytes -= e->size * 8;
+    free(e->data);
+    rw->count--;
+    rw->countdown = 0;
+
+    load_state_from_buffer(rw->gb, (u8*) rw->cur, rw->size);
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,56 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stddef.h>
+
+#include "gb.h"
+#include "types.h"
+
+// snapshots between keyframes
+#define REWIND_KEY_INTERVAL 60
+
+struct rewind_entry {
+    u64* data;
+    // in words
+    size_t size;
+    bool key;
+};
+
+/*
+ring of uncompressed save states of a gb, taken every interval frames and
+dropped oldest first to stay under max_bytes. each snapshot is stored as the
+xor against the keyframe it follows, with the zero runs squeezed out, so it
+costs about as much as the state that changed since the keyframe
+*/
+struct rewind {
+    struct gb* gb;
+    int interval;
+    size_t max_bytes;
+    // taken by the stored snapshots
+    size_t bytes;
+
+    // of an uncompressed state, and in words rounded up
+    size_t size;
+    size_t words;
+    u64* cur;
+    u64* scratch;
+    // uncompressed keyframe the newest entry belongs to, if key_valid
+    u64* key;
+    bool key_valid;
+    int since_key;
+    int countdown;
+
+    struct rewind_entry* entries;
+    int cap;
+    int first;
+    int count;
+};
+
+bool rewind_init(struct rewind* rw, struct gb* gb, int interval,
+                 size_t max_bytes);
+void rewind_free(struct rewind* rw);
+void rewind_clear(struct rewind* rw);
+void rewind_frame(struct rewind* rw);
+bool rewind_step(struct rewind* rw);
+
+#endif
\ No newline at end of file
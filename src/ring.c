@@ -0,0 +1,78 @@
+#include "ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// the size is rounded up to a power of 2 so the free running indices can be
+// masked into the buffer
+bool ring_init(struct audio_ring* r, u32 frames) {
+    u32 size = 1;
+    while (size < frames) size <<= 1;
+    r->buf = calloc(2 * size, sizeof *r->buf);
+    if (!r->buf) return false;
+    r->size = size;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->underruns, 0);
+    atomic_init(&r->overruns, 0);
+    return true;
+}
+
+void ring_free(struct audio_ring* r) {
+    free(r->buf);
+    r->buf = NULL;
+}
+
+// frames queued. exact from either side, and at worst stale for anyone else
+u32 ring_fill(struct audio_ring* r) {
+    return atomic_load_explicit(&r->head, memory_order_acquire) -
+           atomic_load_explicit(&r->tail, memory_order_acquire);
+}
+
+// copies a run of frames starting at index from or to the buffer, wrapping
+static void copy_frames(struct audio_ring* r, u32 index, float* frames, u32 n,
+                        bool to_ring) {
+    u32 start = index & (r->size - 1);
+    u32 first = r->size - start;
+    if (first > n) first = n;
+    float* a = r->buf + 2 * start;
+    if (to_ring) {
+        memcpy(a, frames, 2 * first * sizeof *a);
+        memcpy(r->buf, frames + 2 * first, 2 * (n - first) * sizeof *a);
+    } else {
+        memcpy(frames, a, 2 * first * sizeof *a);
+        memcpy(frames + 2 * first, r->buf, 2 * (n - first) * sizeof *a);
+    }
+}
+
+// producer side. writes as many frames as fit and returns how many that was
+u32 ring_write(struct audio_ring* r, const float* in, u32 frames) {
+    u32 head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    u32 tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    u32 space = r->size - (head - tail);
+    if (frames > space) {
+        atomic_fetch_add_explicit(&r->overruns, frames - space,
+                                  memory_order_relaxed);
+        frames = space;
+    }
+    copy_frames(r, head, (float*) in, frames, true);
+    atomic_store_explicit(&r->head, head + frames, memory_order_release);
+    return frames;
+}
+
+// consumer side. reads up to frames frames and fills the rest of out with
+// silence. returns how many were real
+u32 ring_read(struct audio_ring* r, float* out, u32 frames) {
+    u32 tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    u32 head = atomic_load_explicit(&r->head, memory_order_acquire);
+    u32 n = head - tail;
+    if (n > frames) n = frames;
+    copy_frames(r, tail, out, n, false);
+    atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+    if (n < frames) {
+        memset(out + 2 * n, 0, 2 * (frames - n) * sizeof *out);
+        atomic_fetch_add_explicit(&r->underruns, frames - n,
+                                  memory_order_relaxed);
+    }
+    return n;
+}
\ No newline at end of file
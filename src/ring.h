@@ -0,0 +1,31 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+
+#include "types.h"
+
+/*
+lock free ring of stereo float frames for one producer and one consumer, ie
+the emulator thread writing samples and the audio callback reading them.
+head is only written by the producer and tail only by the consumer
+*/
+struct audio_ring {
+    float* buf;
+    u32 size;
+    _Atomic u32 head;
+    _Atomic u32 tail;
+
+    // frames the consumer wanted but were not there, and frames the producer
+    // had to drop because the ring was full
+    _Atomic unsigned long underruns;
+    _Atomic unsigned long overruns;
+};
+
+bool ring_init(struct audio_ring* r, u32 frames);
+void ring_free(struct audio_ring* r);
+u32 ring_fill(struct audio_ring* r);
+u32 ring_write(struct audio_ring* r, const float* in, u32 frames);
+u32 ring_read(struct audio_ring* r, float* out, u32 frames);
+
+#endif
\ No newline at end of file
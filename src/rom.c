@@ -0,0 +1,164 @@
+#include "rom.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// enough to read the rom size out of the cartridge header
+#define ROM_HEADER_SIZE 0x150
+#define ROM_SIZE_ADDR 0x148
+
+/*
+an image is found again either by the file it came from, which saves mapping
+and checksumming or decompressing it, or by its contents, which lets copies
+of a rom in different files share one image
+*/
+struct rom_entry {
+    u8* data;
+    size_t size;
+    u32 crc;
+    // mapped from a raw file, or malloced and decompressed into
+    bool mapped;
+    dev_t dev;
+    ino_t ino;
+    off_t file_size;
+    time_t mtime;
+    int refs;
+    struct rom_entry* next;
+};
+
+static struct rom_entry* rom_cache;
+static pthread_mutex_t rom_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static u8* map_file(int fd, size_t size) {
+    u8* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+    // it is all about to be read for the checksum anyway
+    madvise(data, size, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+    madvise(data, size, MADV_HUGEPAGE);
+#endif
+    return data;
+}
+
+// decompresses in one pass straight into an image sized from the header
+static u8* load_gz(int fd, size_t* size) {
+    gzFile gz = gzdopen(fd, "rb");
+    if (!gz) {
+        close(fd);
+        return NULL;
+    }
+    gzbuffer(gz, 1 << 17);
+    u8 header[ROM_HEADER_SIZE];
+    u8* data = NULL;
+    if (gzread(gz, header, sizeof header) == sizeof header &&
+        header[ROM_SIZE_ADDR] <= 8) {
+        *size = (size_t) 0x8000 << header[ROM_SIZE_ADDR];
+        data = malloc(*size);
+    }
+    if (data) {
+        memcpy(data, header, sizeof header);
+        unsigned rest = *size - sizeof header;
+        if (gzread(gz, data + sizeof header, rest) != rest) {
+            free(data);
+            data = NULL;
+        }
+    }
+    gzclose(gz);
+    return data;
+}
+
+static void free_image(u8* data, size_t size, bool mapped) {
+    if (mapped) munmap(data, size);
+    else free(data);
+}
+
+// the rom image in the file, which may be gzipped, or null if it cannot be
+// read. size is set to its size and crc to its crc32
+u8* rom_acquire(char* filename, size_t* size, u32* crc) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&rom_cache_lock);
+    struct rom_entry* e;
+    for (e = rom_cache; e; e = e->next) {
+        if (e->dev == st.st_dev && e->ino == st.st_ino &&
+            e->file_size == st.st_size && e->mtime == st.st_mtime) {
+            break;
+        }
+    }
+    if (e) {
+        e->refs++;
+        *size = e->size;
+        *crc = e->crc;
+    }
+    pthread_mutex_unlock(&rom_cache_lock);
+    if (e) {
+        close(fd);
+        return e->data;
+    }
+
+    u8 magic[2];
+    bool gz = pread(fd, magic, 2, 0) == 2 && magic[0] == 0x1f &&
+              magic[1] == 0x8b;
+    u8* data;
+    if (gz) {
+        data = load_gz(fd, size);
+    } else {
+        *size = st.st_size;
+        data = st.st_size ? map_file(fd, *size) : NULL;
+        if (!st.st_size) close(fd);
+    }
+    if (!data) return NULL;
+    *crc = crc32(0, data, *size);
+
+    pthread_mutex_lock(&rom_cache_lock);
+    for (e = rom_cache; e; e = e->next) {
+        if (e->crc == *crc && e->size == *size &&
+            !memcmp(e->data, data, *size)) {
+            break;
+        }
+    }
+    if (e) {
+        e->refs++;
+        free_image(data, *size, !gz);
+    } else {
+        e = malloc(sizeof *e);
+        if (e) {
+            *e = (struct rom_entry){data,        *size,       *crc,
+                                    !gz,         st.st_dev,   st.st_ino,
+                                    st.st_size,  st.st_mtime, 1,
+                                    rom_cache};
+            rom_cache = e;
+        } else {
+            free_image(data, *size, !gz);
+        }
+    }
+    pthread_mutex_unlock(&rom_cache_lock);
+    return e ? e->data : NULL;
+}
+
+void rom_release(u8* data) {
+    if (!data) return;
+    pthread_mutex_lock(&rom_cache_lock);
+    struct rom_entry** p = &rom_cache;
+    while (*p && (*p)->data != data) p = &(*p)->next;
+    struct rom_entry* e = *p;
+    if (e && !--e->refs) {
+        *p = e->next;
+        free_image(e->data, e->size, e->mapped);
+        free(e);
+    }
+    pthread_mutex_unlock(&rom_cache_lock);
+}
\ No newline at end of file
@@ -0,0 +1,16 @@
+#ifndef ROM_H
+#define ROM_H
+
+#include <stddef.h>
+
+#include "types.h"
+
+/*
+rom images shared through a process wide cache, so every cartridge of the
+same game uses one copy however many instances are running. raw files are
+mapped read only and gzipped ones are decompressed into memory
+*/
+u8* rom_acquire(char* filename, size_t* size, u32* crc);
+void rom_release(u8* data);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,74 @@
+#include "sched.h"
+
+#include "gb.h"
+#include "profile.h"
+
+void sched_reset(struct scheduler* sched) {
+    sched->now = 0;
+    sched->next = EV_NEVER;
+    for (int i = 0; i < EV_MAX; i++) sched->time[i] = EV_NEVER;
+}
+
+void sched_add(struct scheduler* sched, enum event ev, u64 time) {
+    sched->time[ev] = time;
+    if (time < sched->next) sched->next = time;
+}
+
+void sched_cancel(struct scheduler* sched, enum event ev) {
+    // next is left as is, sched_run finds nothing due and recomputes it
+    sched->time[ev] = EV_NEVER;
+}
+
+static void run_event(struct gb* gb, enum event ev, u64 time) {
+    switch (ev) {
+        case EV_STAT:
+            PROF_SECTION(PROF_OTHER);
+            check_stat_irq(gb);
+            break;
+        case EV_TIMER:
+            PROF_SECTION(PROF_OTHER);
+            timer_event(gb, time);
+            break;
+        case EV_JOYP:
+            PROF_SECTION(PROF_OTHER);
+            update_joyp(gb);
+            break;
+        case EV_PPU:
+            PROF_SECTION(PROF_PPU);
+            ppu_event(&gb->ppu, time);
+            break;
+        case EV_APU:
+            PROF_SECTION(PROF_APU);
+            apu_event(&gb->apu, time);
+            break;
+        case EV_HDMA:
+            PROF_SECTION(PROF_DMA);
+            hdma_event(gb, time);
+            break;
+        case EV_DMA:
+            PROF_SECTION(PROF_DMA);
+            dma_event(gb, time);
+            break;
+        default:
+            break;
+    }
+}
+
+// runs every event due up to now, earliest first
+void sched_run(struct gb* gb) {
+    struct scheduler* sched = &gb->sched;
+    while (true) {
+        int ev = 0;
+        for (int i = 1; i < EV_MAX; i++) {
+            if (sched->time[i] < sched->time[ev]) ev = i;
+        }
+        u64 time = sched->time[ev];
+        if (time > sched->now) {
+            sched->next = time;
+            break;
+        }
+        sched->time[ev] = EV_NEVER;
+        run_event(gb, ev, time);
+    }
+    PROF_SECTION(PROF_CPU);
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "types.h"
+
+#define EV_NEVER UINT64_MAX
+
+/*
+each subsystem has at most one pending event, timestamped in cpu t-cycles
+(4 per m-cycle in either speed mode). events due on the same t-cycle run in
+the order below, which is the order the subsystems used to be clocked in.
+*/
+enum event {
+    EV_STAT,  // re-evaluate the stat interrupt line
+    EV_TIMER, // tima reload after an overflow
+    EV_JOYP,  // re-evaluate joypad lines
+    EV_PPU,   // ppu mode or ly change
+    EV_APU,   // apu frame sequencer step
+    EV_HDMA,  // vram dma step
+    EV_DMA,   // oam dma step, at the end of an m-cycle
+    EV_MAX
+};
+
+struct scheduler {
+    u64 now;
+    u64 next;
+    u64 time[EV_MAX];
+};
+
+struct gb;
+
+void sched_reset(struct scheduler* sched);
+void sched_add(struct scheduler* sched, enum event ev, u64 time);
+void sched_cancel(struct scheduler* sched, enum event ev);
+void sched_run(struct gb* gb);
+
+#endif
\ No newline at end of file
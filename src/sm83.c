@@ -6,7 +6,28 @@
 
 #include "gb.h"
 
-static void set_flag(struct sm83* cpu, int flag, int val) {
+/*
+the handler for each opcode is made by inlining the decoder below with the
+opcode as a constant, which folds the decoding switches and register lookups
+down to the code for just that instruction. the handlers are dispatched with
+computed goto where the compiler has it and a table of functions otherwise
+*/
+#if defined(__GNUC__) && defined(__OPTIMIZE__)
+#define DECODE static inline __attribute__((always_inline))
+#else
+#define DECODE static
+#endif
+
+#define OPS16(X, h)                                                            \
+    X(h##0) X(h##1) X(h##2) X(h##3) X(h##4) X(h##5) X(h##6) X(h##7)            \
+    X(h##8) X(h##9) X(h##a) X(h##b) X(h##c) X(h##d) X(h##e) X(h##f)
+#define OPS256(X)                                                              \
+    OPS16(X, 0x0) OPS16(X, 0x1) OPS16(X, 0x2) OPS16(X, 0x3)                    \
+    OPS16(X, 0x4) OPS16(X, 0x5) OPS16(X, 0x6) OPS16(X, 0x7)                    \
+    OPS16(X, 0x8) OPS16(X, 0x9) OPS16(X, 0xa) OPS16(X, 0xb)                    \
+    OPS16(X, 0xc) OPS16(X, 0xd) OPS16(X, 0xe) OPS16(X, 0xf)
+
+DECODE void set_flag(struct sm83* cpu, int flag, int val) {
     if (val) {
         cpu->F |= flag;
     } else {
@@ -14,7 +35,7 @@ static void set_flag(struct sm83* cpu, int flag, int val) {
     }
 }
 
-static void resolve_flags(struct sm83* cpu, int flags, u8 pre, u8 post,
+DECODE void resolve_flags(struct sm83* cpu, int flags, u8 pre, u8 post,
                           int carry) {
     set_flag(cpu, FN, flags & FN);
     if (flags & FZ) {
@@ -36,7 +57,32 @@ static void resolve_flags(struct sm83* cpu, int flags, u8 pre, u8 post,
     }
 }
 
-static int eval_cond(struct sm83* cpu, u8 opcode) {
+// the flags are worked out when F is next read, from the same arguments
+DECODE void defer_flags(struct sm83* cpu, int flags, u8 pre, u8 post,
+                        int carry) {
+    set_flag(cpu, FN, flags & FN);
+    cpu->lazy_flags = flags;
+    cpu->lazy_pre = pre;
+    cpu->lazy_post = post;
+    cpu->lazy_carry = carry;
+}
+
+// ops that read F or only change some flags have to flush the pending ones
+// first. ops that set every flag just drop them
+DECODE void flush_flags(struct sm83* cpu) {
+    if (cpu->lazy_flags) {
+        resolve_flags(cpu, cpu->lazy_flags, cpu->lazy_pre, cpu->lazy_post,
+                      cpu->lazy_carry);
+        cpu->lazy_flags = 0;
+    }
+}
+
+void cpu_flush_flags(struct sm83* cpu) {
+    flush_flags(cpu);
+}
+
+DECODE int eval_cond(struct sm83* cpu, u8 opcode) {
+    flush_flags(cpu);
     switch ((opcode & 0b00011000) >> 3) {
         case 0: // NZ
             return !(cpu->F & FZ);
@@ -50,7 +96,7 @@ static int eval_cond(struct sm83* cpu, u8 opcode) {
     return 0;
 }
 
-static u16* getr16mod(struct sm83* cpu, u8 opcode) {
+DECODE u16* getr16mod(struct sm83* cpu, u8 opcode) {
     switch ((opcode & 0b00110000) >> 4) {
         case 0:
             return &cpu->BC;
@@ -64,7 +110,7 @@ static u16* getr16mod(struct sm83* cpu, u8 opcode) {
     return NULL;
 }
 
-static u16* getr16stack(struct sm83* cpu, u8 opcode) {
+DECODE u16* getr16stack(struct sm83* cpu, u8 opcode) {
     switch ((opcode & 0b00110000) >> 4) {
         case 0:
             return &cpu->BC;
@@ -73,12 +119,13 @@ static u16* getr16stack(struct sm83* cpu, u8 opcode) {
         case 2:
             return &cpu->HL;
         case 3:
+            flush_flags(cpu);
             return &cpu->AF;
     }
     return NULL;
 }
 
-static u16 getr16addr(struct sm83* cpu, u8 opcode) {
+DECODE u16 getr16addr(struct sm83* cpu, u8 opcode) {
     switch ((opcode & 0b00110000) >> 4) {
         case 0:
             return cpu->BC;
@@ -92,7 +139,7 @@ static u16 getr16addr(struct sm83* cpu, u8 opcode) {
     return 0;
 }
 
-static u8 getr8src(struct sm83* cpu, u8 opcode) {
+DECODE u8 getr8src(struct sm83* cpu, u8 opcode) {
     switch (opcode & 0b00000111) {
         case 0:
             return cpu->B;
@@ -114,7 +161,7 @@ static u8 getr8src(struct sm83* cpu, u8 opcode) {
     return 0;
 }
 
-static u8* getr8dest(struct sm83* cpu, u8 opcode) {
+DECODE u8* getr8dest(struct sm83* cpu, u8 opcode) {
     switch ((opcode & 0b00111000) >> 3) {
         case 0:
             return &cpu->B;
@@ -136,43 +183,48 @@ static u8* getr8dest(struct sm83* cpu, u8 opcode) {
     return NULL;
 }
 
-static void run_alu(struct sm83* cpu, u8 opcode, u8 op2) {
+DECODE void run_alu(struct sm83* cpu, u8 opcode, u8 op2) {
     u8 pre = cpu->A;
     switch ((opcode & 0b00111000) >> 3) {
         case 0: // ADD
             cpu->A += op2;
-            resolve_flags(cpu, FZ | FH | FC, pre, cpu->A, 0);
+            defer_flags(cpu, FZ | FH | FC, pre, cpu->A, 0);
             break;
         case 1: // ADC
+            flush_flags(cpu);
             cpu->A += op2 + (cpu->F & FC ? 1 : 0);
-            resolve_flags(cpu, FZ | FH | FC, pre, cpu->A, cpu->F & FC);
+            defer_flags(cpu, FZ | FH | FC, pre, cpu->A, cpu->F & FC);
             break;
         case 2: // SUB
             cpu->A -= op2;
-            resolve_flags(cpu, FZ | FN | FH | FC, pre, cpu->A, 0);
+            defer_flags(cpu, FZ | FN | FH | FC, pre, cpu->A, 0);
             break;
         case 3: // SBC
+            flush_flags(cpu);
             cpu->A -= op2 + (cpu->F & FC ? 1 : 0);
-            resolve_flags(cpu, FZ | FN | FH | FC, pre, cpu->A, cpu->F & FC);
+            defer_flags(cpu, FZ | FN | FH | FC, pre, cpu->A, cpu->F & FC);
             break;
         case 4: // AND
+            cpu->lazy_flags = 0;
             cpu->A &= op2;
             set_flag(cpu, FZ, cpu->A == 0);
             cpu->F &= ~(FN | FC);
             cpu->F |= FH;
             break;
         case 5: // XOR
+            cpu->lazy_flags = 0;
             cpu->A ^= op2;
             set_flag(cpu, FZ, cpu->A == 0);
             cpu->F &= ~(FN | FH | FC);
             break;
         case 6: // OR
+            cpu->lazy_flags = 0;
             cpu->A |= op2;
             set_flag(cpu, FZ, cpu->A == 0);
             cpu->F &= ~(FN | FH | FC);
             break;
         case 7: // CP
-            resolve_flags(cpu, FZ | FN | FH | FC, cpu->A, cpu->A - op2, 0);
+            defer_flags(cpu, FZ | FN | FH | FC, cpu->A, cpu->A - op2, 0);
             break;
     }
 }
@@ -188,8 +240,101 @@ static u16 pop(struct sm83* cpu) {
     return lo | (hi << 8);
 }
 
-void run_instruction(struct sm83* cpu) {
-    u8 opcode = cpu_read8(cpu, cpu->PC++);
+DECODE void run_cb_op(struct sm83* cpu, u8 cbcode) {
+    u8 val = getr8src(cpu, cbcode);
+    u8* dest = getr8dest(cpu, cbcode << 3);
+    u8 bit = (cbcode & 0b00111000) >> 3;
+    int store = 1;
+    int c;
+    switch ((cbcode & 0b11000000) >> 6) {
+        case 0:
+            // only RL and RR depend on the old flags
+            if (bit == 2 || bit == 3) flush_flags(cpu);
+            else cpu->lazy_flags = 0;
+            cpu->F &= ~(FN | FH);
+            switch (bit) {
+                case 0: // RLC r
+                    set_flag(cpu, FC, val & 0x80);
+                    val = val << 1 | (cpu->F & FC ? 0x01 : 0);
+                    break;
+                case 1: // RRC r
+                    set_flag(cpu, FC, val & 0x01);
+                    val = val >> 1 | (cpu->F & FC ? 0x80 : 0);
+                    break;
+                case 2: // RL r
+                    c = (cpu->F & FC ? 0x01 : 0);
+                    set_flag(cpu, FC, val & 0x80);
+                    val = val << 1 | c;
+                    break;
+                case 3: // RR r
+                    c = (cpu->F & FC ? 0x80 : 0);
+                    set_flag(cpu, FC, val & 0x01);
+                    val = val >> 1 | c;
+                    break;
+                case 4: // SLA r
+                    set_flag(cpu, FC, val & 0x80);
+                    val <<= 1;
+                    break;
+                case 5: // SRA r
+                    set_flag(cpu, FC, val & 0x01);
+                    val = (s8) val >> 1;
+                    break;
+                case 6: // SWAP r
+                    val = (val & 0xf0) >> 4 | (val & 0x0f) << 4;
+                    cpu->F &= ~FC;
+                    break;
+                case 7: // SRL r
+                    set_flag(cpu, FC, val & 0x01);
+                    val >>= 1;
+                    break;
+            }
+            set_flag(cpu, FZ, val == 0);
+            break;
+        case 1: // BIT b, r
+            flush_flags(cpu);
+            store = 0;
+            cpu->F &= ~FN;
+            cpu->F |= FH;
+            set_flag(cpu, FZ, !(val & (1 << bit)));
+            break;
+        case 2: // RES b, r
+            val &= ~(1 << bit);
+            break;
+        case 3: // SET b, r
+            val |= 1 << bit;
+            break;
+    }
+    if (store) {
+        if (dest) *dest = val;
+        else cpu_write8(cpu, cpu->HL, val);
+    }
+}
+
+#ifdef __GNUC__
+static void run_prefixed(struct sm83* cpu) {
+#define CB_LABEL(n) &&cb_##n,
+    static const void* const cb_labels[256] = {OPS256(CB_LABEL)};
+    goto* cb_labels[cpu_read8(cpu, cpu->PC++)];
+#define CB_CASE(n)                                                             \
+    cb_##n:                                                                    \
+    run_cb_op(cpu, n);                                                         \
+    return;
+    OPS256(CB_CASE)
+}
+#else
+#define CB_HANDLER(n)                                                          \
+    static void cb_##n(struct sm83* cpu) { run_cb_op(cpu, n); }
+OPS256(CB_HANDLER)
+
+#define CB_ENTRY(n) cb_##n,
+static void (*const cb_table[256])(struct sm83*) = {OPS256(CB_ENTRY)};
+
+static void run_prefixed(struct sm83* cpu) {
+    cb_table[cpu_read8(cpu, cpu->PC++)](cpu);
+}
+#endif
+
+DECODE void run_op(struct sm83* cpu, u8 opcode) {
     switch ((opcode & 0b11000000) >> 6) {
         case 0:
             if ((opcode & 0b00000111) == 0) {
@@ -203,10 +348,9 @@ void run_instruction(struct sm83* cpu) {
                             cpu_write16(cpu, addr, cpu->SP);
                             break;
                         case 2: // STOP
-                            cpu->master->div = 0x0000;
+                            reset_div(cpu->master);
                             if (cpu->master->io[KEY1] & 1) {
-                                cpu->master->io[KEY1] =
-                                    ~cpu->master->io[KEY1] & (1 << 7);
+                                switch_speed(cpu->master);
                             } else {
                                 cpu->stop = true;
                             }
@@ -234,9 +378,10 @@ void run_instruction(struct sm83* cpu) {
                             break;
                         case 0b1001: // ADD HL, rr
                             gb_m_cycle(cpu->master);
+                            flush_flags(cpu);
                             u16 prev = cpu->HL;
                             cpu->HL += *getr16mod(cpu, opcode);
-                            resolve_flags(cpu, FH | FC, prev >> 8, cpu->H,
+                            defer_flags(cpu, FH | FC, prev >> 8, cpu->H,
                                           (prev & 0x00ff) > cpu->L);
                             break;
                         case 0b0010: // LD (rr), A
@@ -258,6 +403,7 @@ void run_instruction(struct sm83* cpu) {
                     u8* r;
                     u8 pre, post;
                     u8 c;
+                    if ((opcode & 0b00000011) != 2) flush_flags(cpu);
                     switch (opcode & 0b00000011) {
                         case 0: // INC r
                             if ((r = getr8dest(cpu, opcode))) {
@@ -269,7 +415,7 @@ void run_instruction(struct sm83* cpu) {
                                 post = pre + 1;
                                 cpu_write8(cpu, cpu->HL, post);
                             }
-                            resolve_flags(cpu, FZ | FH, pre, post, 0);
+                            defer_flags(cpu, FZ | FH, pre, post, 0);
                             break;
                         case 1: // DEC r
                             if ((r = getr8dest(cpu, opcode))) {
@@ -281,7 +427,7 @@ void run_instruction(struct sm83* cpu) {
                                 post = pre - 1;
                                 cpu_write8(cpu, cpu->HL, post);
                             }
-                            resolve_flags(cpu, FZ | FN | FH, pre, post, 0);
+                            defer_flags(cpu, FZ | FN | FH, pre, post, 0);
                             break;
                         case 2: // LD r, n
                             u8 n = cpu_read8(cpu, cpu->PC++);
@@ -401,7 +547,7 @@ void run_instruction(struct sm83* cpu) {
                                 gb_m_cycle(cpu->master);
                                 cpu->SP += disp;
                                 cpu->F &= ~FZ;
-                                resolve_flags(cpu, FH | FC, pre & 0x00ff,
+                                defer_flags(cpu, FH | FC, pre & 0x00ff,
                                               cpu->SP & 0x00ff, 0);
                                 break;
                             case 2: // LD A, (FF00+n)
@@ -413,7 +559,7 @@ void run_instruction(struct sm83* cpu) {
                                 gb_m_cycle(cpu->master);
                                 cpu->HL = cpu->SP + disp;
                                 cpu->F &= ~FZ;
-                                resolve_flags(cpu, FH | FC, cpu->SP & 0x00ff,
+                                defer_flags(cpu, FH | FC, cpu->SP & 0x00ff,
                                               cpu->L, 0);
                                 break;
                         }
@@ -483,73 +629,7 @@ void run_instruction(struct sm83* cpu) {
                             cpu->PC = addr;
                             break;
                         case 1: // prefix
-                            u8 cbcode = cpu_read8(cpu, cpu->PC++);
-                            u8 val = getr8src(cpu, cbcode);
-                            u8* dest = getr8dest(cpu, cbcode << 3);
-                            u8 bit = (cbcode & 0b00111000) >> 3;
-                            int store = 1;
-                            int c;
-                            switch ((cbcode & 0b11000000) >> 6) {
-                                case 0:
-                                    cpu->F &= ~(FN | FH);
-                                    switch (bit) {
-                                        case 0: // RLC r
-                                            set_flag(cpu, FC, val & 0x80);
-                                            val = val << 1 |
-                                                  (cpu->F & FC ? 0x01 : 0);
-                                            break;
-                                        case 1: // RRC r
-                                            set_flag(cpu, FC, val & 0x01);
-                                            val = val >> 1 |
-                                                  (cpu->F & FC ? 0x80 : 0);
-                                            break;
-                                        case 2: // RL r
-                                            c = (cpu->F & FC ? 0x01 : 0);
-                                            set_flag(cpu, FC, val & 0x80);
-                                            val = val << 1 | c;
-                                            break;
-                                        case 3: // RR r
-                                            c = (cpu->F & FC ? 0x80 : 0);
-                                            set_flag(cpu, FC, val & 0x01);
-                                            val = val >> 1 | c;
-                                            break;
-                                        case 4: // SLA r
-                                            set_flag(cpu, FC, val & 0x80);
-                                            val <<= 1;
-                                            break;
-                                        case 5: // SRA r
-                                            set_flag(cpu, FC, val & 0x01);
-                                            val = (s8) val >> 1;
-                                            break;
-                                        case 6: // SWAP r
-                                            val = (val & 0xf0) >> 4 |
-                                                  (val & 0x0f) << 4;
-                                            cpu->F &= ~FC;
-                                            break;
-                                        case 7: // SRL r
-                                            set_flag(cpu, FC, val & 0x01);
-                                            val >>= 1;
-                                            break;
-                                    }
-                                    set_flag(cpu, FZ, val == 0);
-                                    break;
-                                case 1: // BIT b, r
-                                    store = 0;
-                                    cpu->F &= ~FN;
-                                    cpu->F |= FH;
-                                    set_flag(cpu, FZ, !(val & (1 << bit)));
-                                    break;
-                                case 2: // RES b, r
-                                    val &= ~(1 << bit);
-                                    break;
-                                case 3: // SET b, r
-                                    val |= 1 << bit;
-                                    break;
-                            }
-                            if (store) {
-                                if (dest) *dest = val;
-                                else cpu_write8(cpu, cpu->HL, val);
-                            }
+                            run_prefixed(cpu);
                             break;
                         case 6: // DI
                             cpu->IME = false;
@@ -596,6 +676,30 @@ void run_instruction(struct sm83* cpu) {
     }
 }
 
+#ifdef __GNUC__
+void run_instruction(struct sm83* cpu) {
+#define OP_LABEL(n) &&op_##n,
+    static const void* const op_labels[256] = {OPS256(OP_LABEL)};
+    goto* op_labels[cpu_read8(cpu, cpu->PC++)];
+#define OP_CASE(n)                                                             \
+    op_##n:                                                                    \
+    run_op(cpu, n);                                                            \
+    return;
+    OPS256(OP_CASE)
+}
+#else
+#define OP_HANDLER(n)                                                          \
+    static void op_##n(struct sm83* cpu) { run_op(cpu, n); }
+OPS256(OP_HANDLER)
+
+#define OP_ENTRY(n) op_##n,
+static void (*const op_table[256])(struct sm83*) = {OPS256(OP_ENTRY)};
+
+void run_instruction(struct sm83* cpu) {
+    op_table[cpu_read8(cpu, cpu->PC++)](cpu);
+}
+#endif
+
 void cpu_isr(struct sm83* cpu) {
     cpu->halt = false;
     if (cpu->master->io[IF] & I_JOYPAD) cpu->stop = false;
@@ -641,6 +745,13 @@ void cpu_clock(struct sm83* cpu) {
 u8 cpu_read8(struct sm83* cpu, u16 addr) {
     gb_m_cycle(cpu->master);
 
+    u8* page = cpu->master->read_map[addr >> 12];
+    if (page) return page[addr & (MEM_PAGE_SIZE - 1)];
+    // hram shares its page with io
+    if (0xff80 <= addr && addr < 0xffff) {
+        return cpu->master->hram[addr - 0xff80];
+    }
+
     if (0x8000 <= addr && addr < 0xa000 &&
         (cpu->master->io[LCDC] & LCDC_ENABLE) &&
         (cpu->master->io[STAT] & STAT_MODE) == 3)
@@ -657,6 +768,16 @@ u8 cpu_read8(struct sm83* cpu, u16 addr) {
 void cpu_write8(struct sm83* cpu, u16 addr, u8 data) {
     gb_m_cycle(cpu->master);
 
+    u8* page = cpu->master->write_map[addr >> 12];
+    if (page) {
+        page[addr & (MEM_PAGE_SIZE - 1)] = data;
+        return;
+    }
+    if (0xff80 <= addr && addr < 0xffff) {
+        cpu->master->hram[addr - 0xff80] = data;
+        return;
+    }
+
     if (cpu->master->dma_active && addr < 0xff00) return;
     if (0x8000 <= addr && addr < 0xa000 &&
         (cpu->master->io[LCDC] & LCDC_ENABLE) &&
@@ -683,6 +804,7 @@ void cpu_write16(struct sm83* cpu, u16 addr, u16 data) {
 }
 
 void print_cpu_state(struct sm83* cpu) {
+    flush_flags(cpu);
     fprintf(stderr,
             "A: %02X F: %02X B: %02X C: %02X D: %02X E: %02X H: %02X "
             "L: %02X SP: %04X PC: %04X (%02X %02X %02X %02X)\n",
@@ -42,6 +42,13 @@ struct sm83 {
     u16 PC;
     bool IME;
 
+    // alu flags not yet written to F, which is only brought up to date when
+    // something reads it. use cpu_flush_flags before looking at F
+    u8 lazy_flags;
+    u8 lazy_pre;
+    u8 lazy_post;
+    bool lazy_carry;
+
 
     bool ei;
     bool halt;
@@ -50,6 +57,7 @@ struct sm83 {
 };
 
 void cpu_clock(struct sm83* cpu);
+void cpu_flush_flags(struct sm83* cpu);
 
 u8 cpu_read8(struct sm83* cpu, u16 addr);
 void cpu_write8(struct sm83* cpu, u16 addr, u8 data);
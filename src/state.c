@@ -0,0 +1,259 @@
+#include "state.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#define FIELD(field)                                                        \
+    {offsetof(struct gb, field), sizeof ((struct gb*) 0)->field}
+#define PART(field)                                                         \
+    offsetof(struct gb, field),                                             \
+        offsetof(struct gb, field) + sizeof ((struct gb*) 0)->field
+
+// parts of struct gb that are never saved, in order: host pointers and
+// config, and whatever load rebuilds from the rest
+static const struct {
+    size_t offset;
+    size_t size;
+} gb_skipped[] = {
+    FIELD(cpu.master),   FIELD(ppu.master),     FIELD(ppu.screen),
+    FIELD(ppu.frame),    FIELD(ppu.bg_colors),  FIELD(ppu.obj_colors),
+    FIELD(ppu.dmg_pal),  FIELD(ppu.tile_rows),  FIELD(ppu.tile_dirty),
+    FIELD(apu.master),   FIELD(apu.sample_buf), FIELD(apu.blip),
+    FIELD(cart),         FIELD(read_map),       FIELD(write_map),
+    FIELD(cfg),
+};
+#define N_SKIPPED (sizeof gb_skipped / sizeof gb_skipped[0])
+
+#define MAX_SECTIONS 8
+
+// bytes start to end of mem. with skip, mem is the gb and the skipped parts
+// are left out
+struct section {
+    char tag[4];
+    u8* mem;
+    size_t start;
+    size_t end;
+    bool skip;
+};
+
+static int get_sections(struct gb* gb, struct section* s) {
+    struct cartridge* cart = gb->cart;
+    int n = 0;
+    s[n++] = (struct section){"CPU ", (u8*) gb, PART(cpu), true};
+    s[n++] = (struct section){"PPU ", (u8*) gb, PART(ppu), true};
+    s[n++] = (struct section){"APU ", (u8*) gb, PART(apu), true};
+    s[n++] = (struct section){"GB  ", (u8*) gb, offsetof(struct gb, cart),
+                              sizeof *gb, true};
+    s[n++] = (struct section){"MBC ", (u8*) &cart->st, 0, sizeof cart->st};
+    if (cart->ram_banks) {
+        s[n++] = (struct section){"SRAM", (u8*) cart->ram, 0,
+                                  cart->ram_banks * SRAM_BANK_SIZE};
+    }
+    if (cart->has_rtc) {
+        s[n++] = (struct section){"RTC ", (u8*) cart->rtc, 0,
+                                  sizeof *cart->rtc};
+    }
+    return n;
+}
+
+// where the saved part of a section starting at pos ends, which is at the
+// next skipped part if there is one in the section. next is set to where the
+// part after it starts, and i to the skipped part to look at from there
+static size_t part_end(struct section* s, size_t pos, int* i, size_t* next) {
+    *next = s->end;
+    if (!s->skip) return s->end;
+    while (*i < N_SKIPPED && gb_skipped[*i].offset < pos) (*i)++;
+    if (*i == N_SKIPPED || gb_skipped[*i].offset >= s->end) return s->end;
+    *next = gb_skipped[*i].offset + gb_skipped[*i].size;
+    return gb_skipped[*i].offset;
+}
+
+// copies a section to or from data, or with data null only counts its size
+static size_t copy_section(struct section* s, u8* data, bool save) {
+    size_t n = 0;
+    size_t pos = s->start;
+    int i = 0;
+    while (pos < s->end) {
+        size_t next;
+        size_t end = part_end(s, pos, &i, &next);
+        if (data && save) memcpy(data + n, s->mem + pos, end - pos);
+        if (data && !save) memcpy(s->mem + pos, data + n, end - pos);
+        n += end - pos;
+        pos = next;
+    }
+    return n;
+}
+
+static uLong hash_section(struct section* s, uLong crc) {
+    size_t pos = s->start;
+    int i = 0;
+    while (pos < s->end) {
+        size_t next;
+        size_t end = part_end(s, pos, &i, &next);
+        crc = crc32_z(crc, s->mem + pos, end - pos);
+        pos = next;
+    }
+    return crc;
+}
+
+static size_t sections_size(struct section* s, int n) {
+    size_t size = 0;
+    for (int i = 0; i < n; i++) size += 8 + copy_section(&s[i], NULL, true);
+    return size;
+}
+
+// a buffer this big fits any state of the gb saved with these flags
+size_t state_max_size(struct gb* gb, int flags) {
+    struct section s[MAX_SECTIONS];
+    size_t size = sections_size(s, get_sections(gb, s));
+    if (flags & STATE_COMPRESS) size = compressBound(size);
+    return sizeof(struct state_header) + size;
+}
+
+// returns the size of the state, or 0 if it did not fit
+size_t save_state_to_buffer(struct gb* gb, u8* buf, size_t size, int flags) {
+    if (flags & STATE_COMPRESS) {
+        size_t raw_size = state_max_size(gb, 0);
+        u8* raw = malloc(raw_size);
+        if (!raw) return 0;
+        raw_size = save_state_to_buffer(gb, raw, raw_size, 0);
+        size = state_compress(raw, raw_size, buf, size);
+        free(raw);
+        return size;
+    }
+
+    struct section s[MAX_SECTIONS];
+    int n = get_sections(gb, s);
+    size_t raw_size = sections_size(s, n);
+    if (size < sizeof(struct state_header) + raw_size) return 0;
+
+    cpu_flush_flags(&gb->cpu);
+    u8* p = buf + sizeof(struct state_header);
+    for (int i = 0; i < n; i++) {
+        u32 len = copy_section(&s[i], p + 8, true);
+        memcpy(p, s[i].tag, 4);
+        memcpy(p + 4, &len, 4);
+        p += 8 + len;
+    }
+
+    struct state_header hdr = {.magic = "GBST",
+                               .version = STATE_VERSION,
+                               .rom_crc = gb->cart->rom_crc,
+                               .size = raw_size,
+                               .stored_size = raw_size};
+    memcpy(hdr.title, gb->cart->title, sizeof hdr.title);
+    memcpy(buf, &hdr, sizeof hdr);
+    return sizeof hdr + raw_size;
+}
+
+/*
+crc32 of what a save state would hold, less the ppu and apu. their internals
+depend on whether frames were drawn and audio mixed, and on how far they were
+last caught up, while everything they do that the game can see is in the
+registers and scheduled events. two gbs that ran the same frames from the same
+state hash the same whatever their config
+*/
+u32 state_hash(struct gb* gb) {
+    struct section s[MAX_SECTIONS];
+    int n = get_sections(gb, s);
+    cpu_flush_flags(&gb->cpu);
+    ppu_sync(&gb->ppu, gb->sched.now);
+    apu_sync(&gb->apu, gb->sched.now);
+    uLong crc = crc32(0, NULL, 0);
+    for (int i = 0; i < n; i++) {
+        if (!memcmp(s[i].tag, "PPU ", 4) || !memcmp(s[i].tag, "APU ", 4)) {
+            continue;
+        }
+        crc = hash_section(&s[i], crc);
+    }
+    return crc;
+}
+
+// deflates an uncompressed state into out, which is best sized with
+// state_max_size. returns the size of the compressed state, or 0 if it did
+// not fit. needs no gb, so it can run off the emulation thread
+size_t state_compress(const u8* state, size_t size, u8* out, size_t out_size) {
+    struct state_header hdr;
+    if (size < sizeof hdr || out_size < sizeof hdr) return 0;
+    memcpy(&hdr, state, sizeof hdr);
+    if ((hdr.flags & STATE_COMPRESS) || hdr.stored_size > size - sizeof hdr) {
+        return 0;
+    }
+    uLongf len = out_size - sizeof hdr;
+    if (compress2(out + sizeof hdr, &len, state + sizeof hdr,
+                  hdr.stored_size, 1) != Z_OK) {
+        return 0;
+    }
+    hdr.flags |= STATE_COMPRESS;
+    hdr.stored_size = len;
+    memcpy(out, &hdr, sizeof hdr);
+    return sizeof hdr + len;
+}
+
+// checks every section is there with the size this build expects, then
+// loads them. the gb is left alone if anything is off
+static bool load_sections(struct gb* gb, u8* raw, size_t raw_size) {
+    struct section s[MAX_SECTIONS];
+    int n = get_sections(gb, s);
+    u8* data[MAX_SECTIONS] = {0};
+    size_t pos = 0;
+    while (pos < raw_size) {
+        if (raw_size - pos < 8) return false;
+        u32 len;
+        memcpy(&len, raw + pos + 4, 4);
+        if (raw_size - pos - 8 < len) return false;
+        for (int i = 0; i < n; i++) {
+            if (memcmp(raw + pos, s[i].tag, 4)) continue;
+            if (data[i] || len != copy_section(&s[i], NULL, false)) {
+                return false;
+            }
+            data[i] = raw + pos + 8;
+        }
+        // sections this build does not know are skipped
+        pos += 8 + len;
+    }
+    for (int i = 0; i < n; i++) {
+        if (!data[i]) return false;
+    }
+    for (int i = 0; i < n; i++) copy_section(&s[i], data[i], false);
+    return true;
+}
+
+bool load_state_from_buffer(struct gb* gb, const u8* buf, size_t size) {
+    struct state_header hdr;
+    if (size < sizeof hdr) return false;
+    memcpy(&hdr, buf, sizeof hdr);
+    if (memcmp(hdr.magic, "GBST", 4) || hdr.version != STATE_VERSION ||
+        hdr.rom_crc != gb->cart->rom_crc ||
+        hdr.stored_size > size - sizeof hdr) {
+        return false;
+    }
+
+    const u8* stored = buf + sizeof hdr;
+    u8* raw;
+    if (hdr.flags & STATE_COMPRESS) {
+        raw = malloc(hdr.size);
+        if (!raw) return false;
+        uLongf len = hdr.size;
+        if (uncompress(raw, &len, stored, hdr.stored_size) != Z_OK ||
+            len != hdr.size) {
+            free(raw);
+            return false;
+        }
+    } else {
+        if (hdr.stored_size != hdr.size) return false;
+        raw = (u8*) stored;
+    }
+    bool ok = load_sections(gb, raw, hdr.size);
+    if (hdr.flags & STATE_COMPRESS) free(raw);
+    if (!ok) return false;
+
+    // the host side was never touched. rebuild what was left out
+    if (gb->cart->battery) gb->cart->sav_dirty = ~0u;
+    update_mem_map(gb);
+    ppu_update_palettes(&gb->ppu);
+    ppu_invalidate_tiles(&gb->ppu);
+    apu_set_sample_rate(&gb->apu, gb->cfg.sample_rate);
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <stddef.h>
+
+#include "gb.h"
+#include "types.h"
+
+// bump whenever a struct that goes into a state changes
+#define STATE_VERSION 2
+
+enum { STATE_COMPRESS = 1 << 0 };
+
+/*
+save state format, in host byte order:
+header: "GBST", version, flags, rom crc32, cartridge title, size of the
+sections and how many bytes of them follow, which are deflated if flags has
+STATE_COMPRESS
+sections: 4 byte tag, size, data. CPU, PPU, APU and GB hold their parts of
+struct gb without host pointers, config or anything rebuilt on load. MBC, SRAM
+and RTC hold the cartridge state
+*/
+struct state_header {
+    char magic[4];
+    u32 version;
+    u32 flags;
+    u32 rom_crc;
+    u8 title[0x10];
+    u32 size;
+    u32 stored_size;
+};
+
+size_t state_max_size(struct gb* gb, int flags);
+size_t save_state_to_buffer(struct gb* gb, u8* buf, size_t size, int flags);
+size_t state_compress(const u8* state, size_t size, u8* out, size_t out_size);
+bool load_state_from_buffer(struct gb* gb, const u8* buf, size_t size);
+u32 state_hash(struct gb* gb);
+
+#endif
\ No newline at end of file